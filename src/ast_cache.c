@@ -0,0 +1,124 @@
+/*
+ * A cache of parsed command lines.
+ *
+ * Lines that are run again, e.g. through history or from a loop, are
+ * looked up by their text instead of being lexed and parsed again.
+ * A command line is not modified after it has been parsed: everything
+ * that belongs to one run of it is kept in the job, so a cached command
+ * line can be shared by any number of jobs.  The cache holds a reference
+ * to each entry and drops the least recently used one when it is full.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ast_cache.h"
+#include "list.h"
+
+#define AST_CACHE_CAPACITY 64
+#define AST_CACHE_BUCKETS 128   /* must be a power of 2 */
+
+struct cache_entry {
+    uint64_t hash;
+    struct ast_command_line *cmdline;
+    struct cache_entry *next;   /* next entry in the same bucket */
+    struct list_elem elem;      /* position in the LRU list */
+    size_t len;
+    char line[];                /* the text the command line was parsed from */
+};
+
+static struct cache_entry *buckets[AST_CACHE_BUCKETS];
+static struct list lru;         /* most recently used entry first */
+static bool initialized;
+static struct ast_cache_stats stats = { .capacity = AST_CACHE_CAPACITY };
+
+/* 64-bit FNV-1a */
+static uint64_t
+hash_line(const char *line, size_t len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char) line[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static struct cache_entry **
+bucket_of(uint64_t hash)
+{
+    return &buckets[hash & (AST_CACHE_BUCKETS - 1)];
+}
+
+/* Unlink 'entry' from its bucket and the LRU list, and free it */
+static void
+remove_entry(struct cache_entry *entry)
+{
+    struct cache_entry **p = bucket_of(entry->hash);
+    while (*p != entry)
+        p = &(*p)->next;
+    *p = entry->next;
+
+    list_remove(&entry->elem);
+    ast_command_line_unref(entry->cmdline);
+    free(entry);
+    stats.entries--;
+}
+
+struct ast_command_line *
+ast_cache_parse(char *line)
+{
+    if (!initialized) {
+        list_init(&lru);
+        initialized = true;
+    }
+
+    size_t len = strlen(line);
+    uint64_t hash = hash_line(line, len);
+
+    for (struct cache_entry *e = *bucket_of(hash); e != NULL; e = e->next) {
+        if (e->hash == hash && e->len == len && memcmp(e->line, line, len) == 0) {
+            list_remove(&e->elem);
+            list_push_front(&lru, &e->elem);
+            stats.hits++;
+            return ast_command_line_ref(e->cmdline);
+        }
+    }
+
+    stats.misses++;
+    struct ast_command_line *cmdline = ast_parse_command_line(line);
+    if (cmdline == NULL)
+        return NULL;
+
+    if (stats.entries == stats.capacity) {
+        remove_entry(list_entry(list_back(&lru), struct cache_entry, elem));
+        stats.evictions++;
+    }
+
+    struct cache_entry *entry = malloc(sizeof *entry + len + 1);
+    entry->hash = hash;
+    entry->cmdline = ast_command_line_ref(cmdline);
+    entry->len = len;
+    memcpy(entry->line, line, len + 1);
+    entry->next = *bucket_of(hash);
+    *bucket_of(hash) = entry;
+    list_push_front(&lru, &entry->elem);
+    stats.entries++;
+    return cmdline;
+}
+
+void
+ast_cache_get_stats(struct ast_cache_stats *s)
+{
+    *s = stats;
+}
+
+void
+ast_cache_clear(void)
+{
+    if (!initialized)
+        return;
+
+    while (!list_empty(&lru))
+        remove_entry(list_entry(list_front(&lru), struct cache_entry, elem));
+}
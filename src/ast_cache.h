@@ -0,0 +1,29 @@
+#ifndef __AST_CACHE_H
+#define __AST_CACHE_H
+
+#include "shell-ast.h"
+
+/* Counters describing the use of the cache */
+struct ast_cache_stats {
+    unsigned long hits;        /* lookups answered from the cache */
+    unsigned long misses;      /* lookups that had to parse the line */
+    unsigned long evictions;   /* entries dropped to make room */
+    int entries;               /* command lines currently cached */
+    int capacity;              /* maximum number of cached command lines */
+};
+
+/* Return the parsed command line for 'line', parsing it only if it is
+ * not in the cache.  Returns NULL if the line has a syntax error.
+ * The caller receives a reference to the command line, which must not
+ * be modified, and drops it with ast_command_line_unref.
+ * The cache must only be used from the shell's main thread.
+ */
+struct ast_command_line * ast_cache_parse(char *line);
+
+/* Retrieve the counters of the cache */
+void ast_cache_get_stats(struct ast_cache_stats *stats);
+
+/* Drop all cached command lines */
+void ast_cache_clear(void);
+
+#endif /* __AST_CACHE_H */
@@ -0,0 +1,322 @@
+/*
+ * The command table.
+ *
+ * Functions, aliases and the locations of programs found in the PATH
+ * are kept in a single hash table keyed by command name, so a command
+ * is resolved with one lookup instead of a chain of string comparisons
+ * followed by a PATH search for every program started.
+ * Entries are created on first use and never removed; an entry whose
+ * fields are all NULL stands for a name that is not (or no longer)
+ * known.
+ *
+ * Builtins are kept apart, in a perfect hash table: a hash function
+ * seeded so that no two builtins share a slot, found again whenever
+ * builtins are registered.  Telling whether a command is a builtin is
+ * then a single probe, which matters because every command that is not
+ * one, and so every program started, makes it.
+ */
+#define _GNU_SOURCE 1
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "commands.h"
+#include "shell-ast.h"
+
+#define COMMAND_BUCKETS 256   /* must be a power of 2 */
+
+static struct command *buckets[COMMAND_BUCKETS];
+static char *path_searched;   /* the PATH the cached locations belong to */
+
+/* 32-bit FNV-1a */
+static uint32_t
+hash_name(const char *name)
+{
+    uint32_t h = 2166136261u;
+    for (const char *p = name; *p; p++) {
+        h ^= (unsigned char) *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+struct command *
+command_lookup(const char *name)
+{
+    struct command *cmd = buckets[hash_name(name) & (COMMAND_BUCKETS - 1)];
+    while (cmd && strcmp(cmd->name, name) != 0)
+        cmd = cmd->next;
+    return cmd;
+}
+
+/* Return the entry for 'name', creating an empty one if needed */
+static struct command *
+find_or_create(const char *name)
+{
+    struct command **bucket = &buckets[hash_name(name) & (COMMAND_BUCKETS - 1)];
+    for (struct command *cmd = *bucket; cmd; cmd = cmd->next)
+        if (strcmp(cmd->name, name) == 0)
+            return cmd;
+
+    size_t len = strlen(name);
+    struct command *cmd = calloc(1, sizeof *cmd + len + 1);
+    memcpy(cmd->name, name, len + 1);
+    cmd->next = *bucket;
+    *bucket = cmd;
+    return cmd;
+}
+
+void
+command_define_function(const char *name, struct ast_command_line *cmdline,
+                        int start, int end)
+{
+    struct command *cmd = find_or_create(name);
+    struct shell_function *old = cmd->function;
+
+    struct shell_function *fn = malloc(sizeof *fn);
+    fn->cmdline = ast_command_line_ref(cmdline);
+    fn->start = start;
+    fn->end = end;
+    cmd->function = fn;
+
+    /* A function may redefine itself while it runs; its caller keeps
+     * its own reference to the command line. */
+    if (old) {
+        ast_command_line_unref(old->cmdline);
+        free(old);
+    }
+}
+
+bool
+command_set_alias(const char *name, const char *value)
+{
+    struct command *cmd = value ? find_or_create(name) : command_lookup(name);
+    if (cmd == NULL || (value == NULL && cmd->alias == NULL))
+        return false;
+
+    free(cmd->alias);
+    cmd->alias = value ? strdup(value) : NULL;
+    return true;
+}
+
+/* Print 'value' in single quotes, as the shell would read it back */
+static void
+print_quoted(FILE *out, const char *value)
+{
+    fputc('\'', out);
+    for (const char *p = value; *p; p++) {
+        if (*p == '\'')
+            fputs("'\"'\"'", out);
+        else
+            fputc(*p, out);
+    }
+    fputc('\'', out);
+}
+
+void
+command_print_aliases(FILE *out)
+{
+    for (int i = 0; i < COMMAND_BUCKETS; i++) {
+        for (struct command *cmd = buckets[i]; cmd; cmd = cmd->next) {
+            if (cmd->alias == NULL)
+                continue;
+            fprintf(out, "alias %s=", cmd->name);
+            print_quoted(out, cmd->alias);
+            fputc('\n', out);
+        }
+    }
+}
+
+/* A registered builtin */
+struct registration {
+    const struct builtin *builtin;
+    bool disabled;          /* by enable -n: the name is left to programs */
+};
+
+static struct registration *registered;     /* every builtin, once */
+static int nregistered;
+
+static struct registration **builtin_slots;
+static unsigned builtin_bits;               /* log2 of the number of slots */
+static uint32_t builtin_seed;
+
+/* The slot of the name whose hash_name is 'h', in a table of 2^bits
+ * slots, with 'seed' */
+static unsigned
+builtin_slot(uint32_t h, uint32_t seed, unsigned bits)
+{
+    return ((h ^ seed) * 2654435761u) >> (32 - bits);
+}
+
+/* Try to place every registered builtin in a table of 2^bits slots
+ * with 'seed'.  Returns false if two of them collide. */
+static bool
+place_builtins(struct registration **slots, unsigned bits, uint32_t seed)
+{
+    memset(slots, 0, (sizeof *slots) << bits);
+    for (int i = 0; i < nregistered; i++) {
+        unsigned k = builtin_slot(hash_name(registered[i].builtin->name), seed, bits);
+        if (slots[k])
+            return false;
+        slots[k] = &registered[i];
+    }
+    return true;
+}
+
+/* Find a table size and a seed for which the builtins do not collide */
+static void
+build_builtin_table(void)
+{
+    unsigned bits = 1;
+    while ((1 << bits) < 2 * nregistered)
+        bits++;
+    for (;; bits++) {
+        struct registration **slots = malloc((sizeof *slots) << bits);
+        for (uint32_t seed = 0; seed < 1000; seed++) {
+            if (place_builtins(slots, bits, seed)) {
+                free(builtin_slots);
+                builtin_slots = slots;
+                builtin_bits = bits;
+                builtin_seed = seed;
+                return;
+            }
+        }
+        free(slots);
+    }
+}
+
+void
+builtin_register(const struct builtin *table, int n)
+{
+    registered = realloc(registered, (nregistered + n) * sizeof *registered);
+    for (int i = 0; i < n; i++) {
+        int k = 0;
+        while (k < nregistered && strcmp(registered[k].builtin->name, table[i].name) != 0)
+            k++;
+        registered[k] = (struct registration) { &table[i], false };
+        if (k == nregistered)
+            nregistered++;
+    }
+    build_builtin_table();
+}
+
+/* Return the registration of 'name', enabled or not, or NULL */
+static struct registration *
+find_registration(const char *name)
+{
+    if (builtin_slots == NULL)
+        return NULL;
+    struct registration *r = builtin_slots[builtin_slot(hash_name(name), builtin_seed, builtin_bits)];
+    return r && strcmp(r->builtin->name, name) == 0 ? r : NULL;
+}
+
+const struct builtin *
+builtin_lookup(const char *name)
+{
+    struct registration *r = find_registration(name);
+    return r && !r->disabled ? r->builtin : NULL;
+}
+
+bool
+builtin_set_enabled(const char *name, bool enabled)
+{
+    struct registration *r = find_registration(name);
+    if (r == NULL)
+        return false;
+    r->disabled = !enabled;
+    return true;
+}
+
+void
+builtin_print(FILE *out)
+{
+    for (int i = 0; i < nregistered; i++)
+        fprintf(out, "enable %s%s\n", registered[i].disabled ? "-n " : "",
+                registered[i].builtin->name);
+}
+
+void
+command_forget_paths(const char *name)
+{
+    if (name) {
+        struct command *cmd = command_lookup(name);
+        if (cmd) {
+            free(cmd->path);
+            cmd->path = NULL;
+        }
+        return;
+    }
+
+    for (int i = 0; i < COMMAND_BUCKETS; i++) {
+        for (struct command *cmd = buckets[i]; cmd; cmd = cmd->next) {
+            free(cmd->path);
+            cmd->path = NULL;
+        }
+    }
+}
+
+/* Return true if 'path' is an executable regular file */
+static bool
+is_executable(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0;
+}
+
+/* Search the directories of 'path' for program 'name', as execvp does.
+ * Returns a malloc'd pathname, or NULL. */
+static char *
+search_path(const char *path, const char *name)
+{
+    size_t namelen = strlen(name);
+    for (const char *dir = path; ; ) {
+        const char *colon = strchrnul(dir, ':');
+        size_t dirlen = colon - dir;
+
+        /* An empty entry stands for the current directory */
+        char candidate[dirlen + namelen + 3];
+        char *p = candidate;
+        if (dirlen == 0)
+            *p++ = '.';
+        p = mempcpy(p, dir, dirlen);
+        *p++ = '/';
+        memcpy(p, name, namelen + 1);
+        if (is_executable(candidate))
+            return strdup(candidate);
+
+        if (*colon == '\0')
+            return NULL;
+        dir = colon + 1;
+    }
+}
+
+const char *
+command_path(const char *name)
+{
+    if (strchr(name, '/'))
+        return name;
+
+    const char *path = getenv("PATH");
+    if (path == NULL)
+        path = "/bin:/usr/bin";
+
+    /* Locations found in a different PATH are no longer valid */
+    if (path_searched == NULL || strcmp(path_searched, path) != 0) {
+        command_forget_paths(NULL);
+        free(path_searched);
+        path_searched = strdup(path);
+    }
+
+    struct command *cmd = command_lookup(name);
+    if (cmd && cmd->path)
+        return cmd->path;
+
+    char *found = search_path(path, name);
+    if (found == NULL)
+        return NULL;
+    cmd = find_or_create(name);
+    cmd->path = found;
+    return found;
+}
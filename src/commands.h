@@ -0,0 +1,89 @@
+#ifndef __COMMANDS_H
+#define __COMMANDS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+struct ast_command_line;
+
+/* A builtin command.  It runs inside the shell and returns one of the
+ * BUILTIN_ values. */
+typedef int builtin_func(int argc, char **argv);
+
+#define BUILTIN_DONE   1    /* the builtin ran */
+#define BUILTIN_EXIT   2    /* the shell should exit */
+#define BUILTIN_RETURN 3    /* return from the current function */
+
+/* The description of a builtin */
+struct builtin {
+    const char *name;
+    builtin_func *func;
+    unsigned flags;
+};
+
+/* Builtin flags */
+#define BUILTIN_PIPELINE 1  /* may run as a stage of a pipeline, in a child */
+
+/* A shell function: the code of command line 'cmdline' from instruction
+ * 'start' up to 'end'.  The function holds a reference to the command
+ * line. */
+struct shell_function {
+    struct ast_command_line *cmdline;
+    int start, end;
+};
+
+/* Everything but a builtin that a command name may stand for.  A name
+ * is tried as a function, an alias, a builtin and a program in the
+ * PATH, in that order. */
+struct command {
+    struct command *next;
+    struct shell_function *function;
+    char *alias;
+    char *path;             /* cached result of the PATH search */
+    char name[];
+};
+
+/* Return the entry for 'name', or NULL if the name is not known yet.
+ * The entry is valid until the next call that modifies the table. */
+struct command *command_lookup(const char *name);
+
+/* Define function 'name', replacing any previous definition */
+void command_define_function(const char *name, struct ast_command_line *cmdline,
+                             int start, int end);
+
+/* Define alias 'name' as 'value', or remove it if 'value' is NULL.
+ * Returns false if 'value' is NULL and there was no such alias. */
+bool command_set_alias(const char *name, const char *value);
+
+/* Print all aliases in the form alias name='value' */
+void command_print_aliases(FILE *out);
+
+/* Register the 'n' builtins described by 'table', which must remain
+ * valid; a builtin with the name of one registered before replaces it.
+ * Builtins are added this way, without changes to the dispatch. */
+void builtin_register(const struct builtin *table, int n);
+
+/* Return the builtin called 'name', or NULL if there is none or it is
+ * disabled.  The builtins are kept in a perfect hash table, so this is
+ * one probe and at most one string comparison. */
+const struct builtin *builtin_lookup(const char *name);
+
+/* Disable builtin 'name', so that the name runs the program of that
+ * name instead, or enable it again.  Returns false if there is no such
+ * builtin. */
+bool builtin_set_enabled(const char *name, bool enabled);
+
+/* Print every builtin as the enable command that gives its state */
+void builtin_print(FILE *out);
+
+/* Return the pathname of the program that runs command 'name', or NULL
+ * if it cannot be found.  Names that contain a / are returned as they
+ * are; others are searched in the PATH, and the result is remembered
+ * until the PATH changes or command_forget_paths is called. */
+const char *command_path(const char *name);
+
+/* Forget the remembered location of 'name', or of all commands if
+ * 'name' is NULL */
+void command_forget_paths(const char *name);
+
+#endif /* __COMMANDS_H */
@@ -0,0 +1,77 @@
+#!/usr/bin/python
+#
+# Tests if, while and for, && and ||, and functions with return: which
+# branch runs, and the $? each of them leaves behind.
+#
+import atexit, proc_check, time
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+#################################################################
+# Step 1. if runs the branch of the first condition that succeeds,
+# and an if without a taken branch leaves $? at 0.
+#
+sendline("if false; then echo one; elif true; then echo two; else echo three; fi; echo st=$?")
+expect_exact("two\r\nst=0", "if did not run the elif branch")
+expect_prompt("Shell did not print expected prompt (2)")
+
+sendline("if false; then echo one; fi; echo st=$?")
+expect_exact("st=0", "if without a taken branch did not set $? to 0")
+expect_prompt("Shell did not print expected prompt (3)")
+
+#################################################################
+# Step 2. for assigns each word in turn; while stops once its
+# condition fails, and a loop that never ran leaves $? at 0.
+#
+sendline("for w in a b c; do echo w=$w; done")
+expect_exact("w=a\r\nw=b\r\nw=c", "for did not iterate over its words")
+expect_prompt("Shell did not print expected prompt (4)")
+
+sendline("n=x; while test $n != xxx; do n=${n}x; echo n=$n; done; echo st=$?")
+expect_exact("n=xx\r\nn=xxx\r\nst=0", "while did not stop when its condition failed")
+expect_prompt("Shell did not print expected prompt (5)")
+
+sendline("while false; do echo never; done; echo st=$?")
+expect_exact("st=0", "a while loop that never ran did not set $? to 0")
+expect_prompt("Shell did not print expected prompt (6)")
+
+#################################################################
+# Step 3. && and || run their right side depending on the status of
+# the left one, and $? is that of the last command run.
+#
+sendline("false && echo and; echo st=$?")
+expect_exact("st=1", "&& ran its right side after a failure")
+expect_prompt("Shell did not print expected prompt (7)")
+
+sendline("false || echo or; echo st=$?")
+expect_exact("or\r\nst=0", "|| did not run its right side after a failure")
+expect_prompt("Shell did not print expected prompt (8)")
+
+sendline("true && false; echo st=$?")
+expect_exact("st=1", "$? after && is not that of its right side")
+expect_prompt("Shell did not print expected prompt (9)")
+
+sendline("true || false; echo st=$?")
+expect_exact("st=0", "|| ran its right side after a success")
+expect_prompt("Shell did not print expected prompt (10)")
+
+#################################################################
+# Step 4. A function gets its arguments as $1..., and return leaves
+# it at once with the status given, which if then tests.
+#
+sendline("f() { echo arg=$1; return 3; echo after; }")
+expect_prompt("Shell did not print expected prompt (11)")
+
+sendline("f x; echo st=$?")
+expect_exact("arg=x\r\nst=3", "return did not leave the function with its status")
+expect_prompt("Shell did not print expected prompt (12)")
+
+sendline("if f y; then echo taken; else echo st=$?; fi")
+expect_exact("arg=y\r\nst=3", "if did not test the status of the function")
+expect_prompt("Shell did not print expected prompt (13)")
+
+test_success()
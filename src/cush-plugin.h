@@ -0,0 +1,106 @@
+/*
+ * The interface between cush and its plugins.
+ *
+ * A plugin is a shared object that adds builtins to the shell.  It is
+ * loaded with enable -f plugin.so [name...], or at startup from the
+ * plugin directory given with cush -p dir.  It defines a descriptor
+ * named cush_plugin that lists its builtins:
+ *
+ *     #include "cush-plugin.h"
+ *
+ *     static int
+ *     hello(const struct cush_call *call)
+ *     {
+ *         dprintf(call->out, "hello, %s\n", call->argc > 1 ? call->argv[1] : "world");
+ *         return 0;
+ *     }
+ *
+ *     const struct cush_plugin cush_plugin = {
+ *         CUSH_PLUGIN_ABI,
+ *         (const struct cush_plugin_builtin[]) {
+ *             { "hello", hello },
+ *             { NULL, NULL }
+ *         }
+ *     };
+ *
+ * built with cc -shared -fPIC -o hello.so hello.c.
+ *
+ * The interface only grows: new fields are added at the end of the
+ * structures, and the structures the shell fills in or hands out start
+ * with their size, so a plugin can tell which fields it may use.  A
+ * change that breaks plugins built before it changes CUSH_PLUGIN_ABI,
+ * and the shell refuses plugins built for another one.
+ */
+#ifndef CUSH_PLUGIN_H
+#define CUSH_PLUGIN_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define CUSH_PLUGIN_ABI 1
+
+struct cush_shell;
+
+/* A run of a builtin.  The builtin runs inside the shell, or in a child
+ * of it when it is a stage of a pipeline or a background job; either
+ * way its standard input, output and error are 'in', 'out' and 'err',
+ * which are also descriptors 0, 1 and 2 while it runs. */
+struct cush_call {
+    size_t size;                    /* sizeof (struct cush_call) */
+    const struct cush_shell *shell;
+    int argc;
+    char **argv;                    /* argv[0] is the builtin's name */
+    int in, out, err;
+};
+
+/* A builtin returns its exit status */
+typedef int cush_builtin_fn(const struct cush_call *call);
+
+struct cush_plugin_builtin {
+    const char *name;
+    cush_builtin_fn *run;
+};
+
+/* The descriptor a plugin defines as cush_plugin */
+struct cush_plugin {
+    int abi;                                    /* CUSH_PLUGIN_ABI */
+    const struct cush_plugin_builtin *builtins; /* ends with a NULL name */
+};
+
+/* The states of a job */
+#define CUSH_JOB_FOREGROUND 0
+#define CUSH_JOB_RUNNING    1   /* in the background */
+#define CUSH_JOB_STOPPED    2
+#define CUSH_JOB_DONE       3   /* but not yet reported */
+
+/* A job of the shell's job table */
+struct cush_job {
+    size_t size;        /* set by the plugin to sizeof (struct cush_job) */
+    int jid;
+    int state;
+    pid_t pgid;
+    int nprocs;         /* number of processes in its pipeline */
+    int nalive;         /* number of them not yet reaped */
+    int exit_status;    /* its $?, once it is done */
+};
+
+/* What the shell offers its plugins */
+struct cush_shell {
+    size_t size;        /* sizeof (struct cush_shell) */
+
+    /* Return the value of variable 'name', or NULL if it is not set */
+    const char *(*get_var)(const char *name);
+
+    /* Set shell variable 'name' to 'value' */
+    void (*set_var)(const char *name, const char *value);
+
+    /* Return the id of the first job after job 'jid', or of the first
+     * job if 'jid' is 0; returns 0 after the last one */
+    int (*next_job)(int jid);
+
+    /* Describe job 'jid' in 'job', whose size the caller sets.
+     * Returns 0, or -1 if there is no such job. */
+    int (*get_job)(int jid, struct cush_job *job);
+};
+
+#endif /* CUSH_PLUGIN_H */
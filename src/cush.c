@@ -6,8 +6,8 @@
  */
 #define _GNU_SOURCE 1
 #include <stdio.h>
+#include <ctype.h>
 #include <readline/readline.h>
-#include <readline/history.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
@@ -17,6 +17,15 @@
 #include <spawn.h>
 #include <time.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
 
 /* Since the handed out code contains a number of unused functions. */
 #pragma GCC diagnostic ignored "-Wunused-function"
@@ -24,19 +33,51 @@
 #include "termstate_management.h"
 #include "signal_support.h"
 #include "shell-ast.h"
+#include "list.h"
 #include "utils.h"
+#include "expand.h"
+#include "variables.h"
+#include "ast_cache.h"
+#include "commands.h"
+#include "utilities.h"
+#include "plugins.h"
+#include "hist.h"
 
 static void handle_child_status(pid_t pid, int status);
 
-static int runBuiltIn(struct ast_pipeline *currpipeline);
+static int run_code(struct ast_command_line *cline, int pc, int end, int outfd);
+
+/* A command that runs inside the shell rather than as a program: an
+ * assignment, a function or a builtin */
+struct shell_command
+{
+    struct shell_function *function;
+    const struct builtin *builtin;
+};
+
+/* The words and redirection targets of a pipeline once they have been
+ * expanded.  The pipeline itself is never modified, since it may be
+ * cached and run again. */
+struct expanded_pipeline
+{
+    char ***argvs;      /* argv of each command */
+    const char *input;  /* file standard input is redirected from, or NULL */
+    const char *output; /* file standard output is redirected to, or NULL */
+};
+
+static bool find_shell_command(char **argv, struct shell_command *sc);
+static int run_shell_command(struct shell_command *sc, char **argv, int outfd);
 
 extern char **environ;
 
 static void
 usage(char *progname)
 {
-    printf("Usage: %s -h\n"
-           " -h            print this help\n",
+    printf("Usage: %s [-h] [-p dir] [-c command | script]\n"
+           " -h            print this help\n"
+           " -p dir        load the plugins in dir\n"
+           " -c command    run command and exit\n"
+           " script        run the commands in file script and exit\n",
            progname);
 
     exit(EXIT_SUCCESS);
@@ -73,6 +114,15 @@ struct job
 
     /* Add additional fields here if needed. */
     pid_t pgid;
+    char *coproc_name; /* Name if this job is a coprocess, else NULL */
+    int coproc_in;     /* Shell's end of the coprocess's stdin, or -1 */
+    int coproc_out;    /* Shell's end of the coprocess's stdout, or -1 */
+    pid_t *pids;       /* pid of each command of the pipeline, which
+                          itself is shared and never modified */
+    unsigned long last_active; /* job_clock when it was last started in the
+                                  background, stopped or continued */
+    int exit_status;   /* Exit status of the pipeline's last command, for $? */
+    int stop_signal;   /* Signal that last stopped one of its processes */
 };
 
 /* Utility functions for job list management.
@@ -85,6 +135,10 @@ static struct list job_list;
 
 static struct job *jid2job[MAXJOBS];
 
+/* Orders the jobs by when they were last active: the current job, %+,
+ * is the one that was last, and the previous job, %-, the one before */
+static unsigned long job_clock;
+
 /* Return job corresponding to jid */
 static struct job *
 get_job_from_jid(int jid)
@@ -99,12 +153,21 @@ get_job_from_jid(int jid)
 static struct job *
 add_job(struct ast_pipeline *pipe)
 {
-    struct job *job = malloc(sizeof *job);
+    struct job *job = malloc(sizeof *job + pipe->ncommands * sizeof *job->pids);
     job->pipe = pipe;
+    job->pids = (pid_t *)(job + 1);
+    memset(job->pids, 0, pipe->ncommands * sizeof *job->pids);
+    job->last_active = ++job_clock;
     job->num_processes_alive = 0;
+    job->exit_status = 0;
+    job->stop_signal = 0;
     list_push_back(&job_list, &job->elem);
     job->pgid = 0;
     job->jid = 0;
+    job->coproc_name = NULL;
+    job->coproc_in = job->coproc_out = -1;
+    if (pipe->cmdline)
+        ast_command_line_ref(pipe->cmdline); // the job uses the pipeline's words
     if (pipe->bg_job)
     {
         job->status = BACKGROUND;
@@ -124,6 +187,32 @@ add_job(struct ast_pipeline *pipe)
     return NULL;
 }
 
+/* Close the shell's ends of a coprocess's pipes and remove the
+ * variables that advertise them, unless a later coprocess of the same
+ * name has taken them over.  Its pipes cannot have the descriptors of
+ * this one's, which are still open, so NAME_IN tells them apart. */
+static void
+coproc_close(struct job *job)
+{
+    char var[strlen(job->coproc_name) + 5];
+    char val[32];
+    snprintf(var, sizeof var, "%s_IN", job->coproc_name);
+    snprintf(val, sizeof val, "/dev/fd/%d", job->coproc_in);
+    const char *current = getenv(var);
+    if (current && strcmp(current, val) == 0)
+    {
+        static const char *suffixes[] = {"_IN", "_OUT", "_PID"};
+        for (int i = 0; i < 3; i++)
+        {
+            snprintf(var, sizeof var, "%s%s", job->coproc_name, suffixes[i]);
+            unsetenv(var);
+        }
+    }
+    close(job->coproc_in);
+    close(job->coproc_out);
+    free(job->coproc_name);
+}
+
 /* Delete a job.
  * This should be called only when all processes that were
  * forked for this job are known to have terminated.
@@ -135,7 +224,15 @@ delete_job(struct job *job)
     assert(jid != -1);
     jid2job[jid]->jid = -1;
     jid2job[jid] = NULL;
-    // ast_pipeline_free(job->pipe);
+    if (job->pipe->cmdline)
+        ast_command_line_unref(job->pipe->cmdline);
+    if (job->coproc_name)
+    {
+        // The pipeline of a coprocess was built by the coproc builtin
+        // and belongs to its job
+        coproc_close(job);
+        ast_pipeline_free(job->pipe);
+    }
     free(job);
 }
 
@@ -146,9 +243,14 @@ remove_from_list(struct job *job)
     delete_job(job);
 }
 
+/* Set when the user interrupts the shell with ^C, either directly or
+ * by interrupting a foreground job.  Loops stop when it is set. */
+static volatile sig_atomic_t interrupted;
+
 /* Signal Handler for SIGINT */
 static void sigintHandler(int sig_num)
 {
+    interrupted = 1;
     signal(SIGINT, sigintHandler);
 }
 
@@ -176,11 +278,10 @@ get_status(enum job_status status)
 static void
 print_cmdline(struct ast_pipeline *pipeline)
 {
-    struct list_elem *e = list_begin(&pipeline->commands);
-    for (; e != list_end(&pipeline->commands); e = list_next(e))
+    for (int i = 0; i < pipeline->ncommands; i++)
     {
-        struct ast_command *cmd = list_entry(e, struct ast_command, elem);
-        if (e != list_begin(&pipeline->commands))
+        struct ast_command *cmd = &pipeline->commands[i];
+        if (i > 0)
             printf("| ");
         char **p = cmd->argv;
         printf("%s", *p++);
@@ -255,11 +356,15 @@ wait_for_job(struct job *job)
 {
     assert(signal_is_blocked(SIGCHLD));
 
+    // Without job control, a stopped job is waited for until it is
+    // continued and finishes, as it stops together with the shell in a
+    // pipeline.
+    int options = termstate_has_terminal() ? WUNTRACED : 0;
     while (job->status == FOREGROUND && job->num_processes_alive > 0)
     {
         int status;
 
-        pid_t child = waitpid(-1, &status, WUNTRACED);
+        pid_t child = waitpid(-1, &status, options);
 
         // When called here, any error returned by waitpid indicates a logic
         // bug in the shell.
@@ -310,17 +415,13 @@ handle_child_status(pid_t pid, int status)
             // We can access the element with respect to list_entry
             job = list_entry(e, struct job, elem);
 
-            struct ast_command *com = NULL;
             // use a for loop to iterate every process in one job
-            for (struct list_elem *p = list_begin(&job->pipe->commands);
-                 p != list_end(&job->pipe->commands); p = list_next(p))
+            for (int i = 0; i < job->pipe->ncommands; i++)
             {
-
-                com = list_entry(p, struct ast_command, elem);
                 // If their pid correspond to one another, we may break
                 // the for loop and use the current job.
 
-                if (com->pid == pid)
+                if (job->pids[i] == pid)
                 {
                     found = job->jid;
                     break;
@@ -344,6 +445,16 @@ handle_child_status(pid_t pid, int status)
         }
         else
         {
+            // The status of a pipeline is that of its last command.
+            if (pid == job->pids[job->pipe->ncommands - 1])
+            {
+                if (WIFEXITED(status))
+                    job->exit_status = WEXITSTATUS(status);
+                else if (WIFSIGNALED(status))
+                    job->exit_status = 128 + WTERMSIG(status);
+                if (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT && job->status == FOREGROUND)
+                    interrupted = 1;
+            }
 
             if (WIFEXITED(status))
             {
@@ -402,10 +513,12 @@ handle_child_status(pid_t pid, int status)
 
                 // The status of the job must be set STOPPED in the enumerator job_status by default.
                 job->status = STOPPED;
+                job->last_active = ++job_clock;
                 termstate_save(&job->saved_tty_state);
 
                 // Later, the status of the process may be modified automatically.
                 int stpNum = WSTOPSIG(status);
+                job->stop_signal = stpNum;
 
                 // The background stage can be depicted in two possibiltiies: (1) stpNum == SIGTTOU
                 // | stpNum == SIGTTIN. (2) we print the job.
@@ -425,15 +538,136 @@ handle_child_status(pid_t pid, int status)
     {
         utils_fatal_error("Error in waiting for signal from the child process");
     }
+
+    // A foreground job keeps the terminal while it runs, even after one
+    // of its processes, or a background job, changed state, so that ^C
+    // still reaches the rest of its pipeline.
+    for (struct list_elem *e = list_begin(&job_list); e != list_end(&job_list); e = list_next(e))
+    {
+        struct job *job = list_entry(e, struct job, elem);
+        if (job->status == FOREGROUND && job->num_processes_alive > 0)
+            return;
+    }
     termstate_give_terminal_back_to_shell();
 }
 
-static void execute(struct ast_pipeline *currpipeline)
+/* The flags to open the file of the output redirection of 'pipe' */
+static int
+output_flags(struct ast_pipeline *pipe)
 {
-    // We would like to add jobs to the current pipeline
-    struct job *job = add_job(currpipeline);
+    return O_WRONLY | O_CREAT | (pipe->append_to_output ? O_APPEND : O_TRUNC);
+}
+
+/* Open 'path' for a redirection, reporting failure */
+static int
+open_redirection(const char *path, int flags)
+{
+    int fd = open(path, flags | O_CLOEXEC, S_IRWXU);
+    if (fd == -1)
+        fprintf(stderr, "cush: %s: %s\n", path, strerror(errno));
+    return fd;
+}
+
+/* Put the calling process into the process group of 'job', as
+ * posix_spawnp does for its programs, and give the job the terminal if
+ * this is its first process and it runs in the foreground.  Called by
+ * both the child and the parent, whichever runs first. */
+static void
+join_job_group(struct job *job, pid_t pid)
+{
+    bool foreground = !job->pipe->bg_job;
+    if (foreground && !termstate_has_terminal())
+        return;
+
+    pid_t pgid = job->pgid ? job->pgid : pid;
+    setpgid(pid, pgid);
+    if (foreground && job->pgid == 0 && pid == getpid())
+    {
+        signal_block(SIGTTOU);
+        tcsetpgrp(termstate_get_tty_fd(), pgid);
+        signal_unblock(SIGTTOU);
+    }
+}
+
+/* Fork a child that runs the builtin or function 'sc' as command 'i' of
+ * 'job', with the standard input and output start_job would give a
+ * program.  'ex' has the pipeline's redirection targets and 'pipes' the
+ * pipes between its commands.  Returns the child's pid, or -1. */
+static pid_t
+fork_stage(struct job *job, int i, struct shell_command *sc, char **argv,
+           const struct expanded_pipeline *ex, int infd, int outfd, int (*pipes)[2])
+{
+    struct ast_pipeline *pipe = job->pipe;
+    int last = pipe->ncommands - 1;
+
+    pid_t child = fork();
+    if (child != 0)
+    {
+        if (child > 0)
+            join_job_group(job, child);
+        return child;
+    }
+
+    join_job_group(job, getpid());
+    // Like a subshell, the child does no job control: the programs it
+    // runs stay in the job's process group, and stop and continue with
+    // the rest of the job.
+    termstate_release();
+    signal(SIGINT, SIG_DFL);
+    signal_unblock(SIGCHLD);
+    // The job is the parent's business; jobs in a pipeline should
+    // not list itself.
+    list_remove(&job->elem);
+
+    int in = i > 0 ? pipes[i - 1][0] : infd;
+    if (i == 0 && ex->input && (in = open_redirection(ex->input, O_RDONLY)) == -1)
+        _exit(1);
+    int out = i < last ? pipes[i][1] : outfd;
+    if (i == last && ex->output
+        && (out = open_redirection(ex->output, output_flags(pipe))) == -1)
+        _exit(1);
+
+    if (in != -1)
+        dup2(in, STDIN_FILENO);
+    if (out != -1)
+        dup2(out, STDOUT_FILENO);
+    if (pipe->commands[i].dup_stderr_to_stdout)
+        dup2(STDOUT_FILENO, STDERR_FILENO);
+    // The pipes are close-on-exec, but there is no exec here, and a
+    // reader only sees the end of its input once every writer is gone.
+    for (int k = 0; k < last; k++)
+    {
+        close(pipes[k][0]);
+        close(pipes[k][1]);
+    }
+
+    if (sc->builtin && !(sc->builtin->flags & BUILTIN_PIPELINE))
+    {
+        fprintf(stderr, "cush: %s: cannot run in a pipeline or in the background\n", argv[0]);
+        _exit(1);
+    }
+    run_shell_command(sc, argv, -1);
+    fflush(NULL);
+    _exit(var_status());
+}
+
+/* Spawn all processes of 'job'.
+ * 'ex' holds the expanded words and redirection targets of its pipeline,
+ * or is NULL to run the commands as they were parsed.
+ * If 'infd' is not -1, the first command's standard input is connected
+ * to it, and if 'outfd' is not -1, the last command's standard output.
+ * Builtins and functions run in a child of the shell.
+ * SIGCHLD must be blocked.  Returns 0 on success, or the error returned
+ * by posix_spawn for the command that could not be started.
+ */
+static int start_job(struct job *job, const struct expanded_pipeline *ex, int infd, int outfd)
+{
+    struct ast_pipeline *currpipeline = job->pipe;
+    struct expanded_pipeline parsed = {NULL, currpipeline->iored_input, currpipeline->iored_output};
+    if (ex == NULL)
+        ex = &parsed;
 
-    int size = list_size(&currpipeline->commands) - 1;
+    int size = currpipeline->ncommands - 1;
     if (size == 0)
     {
         size++;
@@ -470,14 +704,15 @@ static void execute(struct ast_pipeline *currpipeline)
     //     }
     // }
 
-    signal_block(SIGCHLD);
+    assert(signal_is_blocked(SIGCHLD));
+    // Output the shell has buffered must come before that of the job,
+    // which matters when stdout is not a terminal.
+    fflush(stdout);
     // int inputfd = -1;
     // int outputfd = -1;
 
-    int commndNum = 0;
     int success = -1; // the child process
-    for (struct list_elem *e = list_begin(&currpipeline->commands); e != list_end(&currpipeline->commands);
-         e = list_next(e))
+    for (int commndNum = 0; commndNum < currpipeline->ncommands; commndNum++)
     {
         pid_t child; // a child is established.
         posix_spawn_file_actions_t file_actions;
@@ -486,7 +721,8 @@ static void execute(struct ast_pipeline *currpipeline)
         posix_spawnattr_t attr;
         posix_spawnattr_init(&attr);
 
-        struct ast_command *command = list_entry(e, struct ast_command, elem);
+        struct ast_command *command = &currpipeline->commands[commndNum];
+        char **argv = ex->argvs ? ex->argvs[commndNum] : command->argv;
 
         if (currpipeline->bg_job)
         {
@@ -505,7 +741,12 @@ static void execute(struct ast_pipeline *currpipeline)
         {
             job->status = FOREGROUND;
             // posix_spawnattr_tcsetpgrp_np(&attr, termstate_get_tty_fd());
-            if (job->pgid == 0)
+            if (!termstate_has_terminal())
+            {
+                // Without a terminal there is no job control, and
+                // foreground jobs stay in the shell's process group.
+            }
+            else if (job->pgid == 0)
             {
                 posix_spawnattr_setflags(&attr, POSIX_SPAWN_TCSETPGROUP | POSIX_SPAWN_SETPGROUP);
 
@@ -520,26 +761,27 @@ static void execute(struct ast_pipeline *currpipeline)
         }
 
         // addopen(open)
-        if (e == list_begin(&currpipeline->commands))
+        if (commndNum == 0)
         {
-            if (currpipeline->iored_input)
+            if (ex->input)
+            {
+                posix_spawn_file_actions_addopen(&file_actions, 0, ex->input, O_RDONLY, 0);
+            }
+            else if (infd != -1)
             {
-                posix_spawn_file_actions_addopen(&file_actions, 0, currpipeline->iored_input, O_RDONLY, 0);
+                posix_spawn_file_actions_adddup2(&file_actions, infd, STDIN_FILENO);
             }
         }
 
-        if (e == list_rbegin(&currpipeline->commands))
+        if (commndNum == currpipeline->ncommands - 1)
         {
-            if (currpipeline->iored_output)
+            if (ex->output)
             {
-                if (currpipeline->append_to_output)
-                {
-                    posix_spawn_file_actions_addopen(&file_actions, 1, currpipeline->iored_output, O_WRONLY | O_CREAT | O_APPEND, S_IRWXU);
-                }
-                else
-                {
-                    posix_spawn_file_actions_addopen(&file_actions, 1, currpipeline->iored_output, O_WRONLY | O_CREAT, S_IRWXU);
-                }
+                posix_spawn_file_actions_addopen(&file_actions, 1, ex->output, output_flags(currpipeline), S_IRWXU);
+            }
+            else if (outfd != -1)
+            {
+                posix_spawn_file_actions_adddup2(&file_actions, outfd, STDOUT_FILENO);
             }
         }
 
@@ -549,7 +791,7 @@ static void execute(struct ast_pipeline *currpipeline)
         //  (3) check it is the last
         //  (4) check it is the middle
 
-        if (list_size(&currpipeline->commands) > 1)
+        if (currpipeline->ncommands > 1)
         {
             if (commndNum == 0)
             {
@@ -574,14 +816,36 @@ static void execute(struct ast_pipeline *currpipeline)
             posix_spawn_file_actions_adddup2(&file_actions, STDOUT_FILENO, STDERR_FILENO);
         }
 
-        // This is the scenario used to handle the child status.
-        success = posix_spawnp(&child, command->argv[0], &file_actions, &attr, command->argv, environ);
+        struct shell_command sc;
+        if (find_shell_command(argv, &sc))
+        {
+            child = fork_stage(job, commndNum, &sc, argv, ex, infd, outfd, pipes);
+            success = child == -1 ? errno : 0;
+        }
+        else
+        {
+            // This is the scenario used to handle the child status.
+            // The program is located through the command table's PATH cache;
+            // if it has moved since, it is searched for once more.  Since the
+            // path contains a /, posix_spawnp does not search the PATH again;
+            // it is used because only ../posix_spawn supports TCSETPGROUP.
+            const char *path = command_path(argv[0]);
+            success = path ? posix_spawnp(&child, path, &file_actions, &attr, argv, environ) : ENOENT;
+            if (success == ENOENT && path && path != argv[0])
+            {
+                command_forget_paths(argv[0]);
+                path = command_path(argv[0]);
+                success = path ? posix_spawnp(&child, path, &file_actions, &attr, argv, environ) : ENOENT;
+            }
+        }
+        posix_spawn_file_actions_destroy(&file_actions);
+        posix_spawnattr_destroy(&attr);
         if (success != 0)
         {
             fprintf(stderr, "no such file or directory\n");
             break;
         }
-        command->pid = child;
+        job->pids[commndNum] = child;
 
         // The process group id is supposed to be the first process id.
         if (commndNum == 0)
@@ -595,7 +859,6 @@ static void execute(struct ast_pipeline *currpipeline)
         }
 
         job->num_processes_alive++;
-        commndNum++;
     }
 
     // The parent process pid
@@ -605,6 +868,17 @@ static void execute(struct ast_pipeline *currpipeline)
         close(pipes[i][1]);
     }
 
+    return success;
+}
+
+static void execute(struct ast_pipeline *currpipeline, const struct expanded_pipeline *ex, int outfd)
+{
+    // We would like to add jobs to the current pipeline
+    struct job *job = add_job(currpipeline);
+
+    signal_block(SIGCHLD);
+    int success = start_job(job, ex, -1, outfd);
+
     // termstate_save(&job->saved_tty_state);
 
     if (success == 0)
@@ -617,6 +891,7 @@ static void execute(struct ast_pipeline *currpipeline)
         remove_from_list(job);
         termstate_give_terminal_back_to_shell();
         signal_unblock(SIGCHLD);
+        var_set_status(127);
         return;
     }
 
@@ -625,13 +900,14 @@ static void execute(struct ast_pipeline *currpipeline)
         wait_for_job(job);
     }
  */
-    if (job->status == BACKGROUND)
+    if (job->status == BACKGROUND && termstate_has_terminal())
     {
         printf("[%d] %d\n", job->jid, job->pgid);
     }
 
     if (job->status == DONE)
     {
+        var_set_status(job->exit_status);
         remove_from_list(job);
     }
 
@@ -640,345 +916,2431 @@ static void execute(struct ast_pipeline *currpipeline)
     // signal_unblock(SIGCHLD);
 }
 
-static int runBuiltIn(struct ast_pipeline *currpipeline)
+/* Send 'sig' to the process group of 'job', which also reaches the
+ * processes its commands started themselves.  While SIGCHLD is blocked
+ * and some of its processes have not been reaped, the group id cannot
+ * have been reused; once all of them have, the job is not signalled.
+ * Returns 0, or -1 with errno set if no process could be signalled. */
+static int
+signal_job(struct job *job, int sig)
 {
-    struct ast_command *command = list_entry(list_begin(&currpipeline->commands), struct ast_command, elem);
-    char **argv = command->argv; // the argument array
-    int argc = 0;                // the number of arguments in a command
-
-    while (*(argv + argc) != NULL)
+    assert(signal_is_blocked(SIGCHLD));
+    if (job->num_processes_alive == 0)
     {
-        argc++;
+        errno = ESRCH;
+        return -1;
     }
+    return killpg(job->pgid, sig);
+}
+
+/* A job pool runs pipelines through the job list while keeping at most
+ * 'max_running' of them alive at the same time.  It is used by builtins
+ * such as 'parallel' that fan out work without oversubscribing the machine.
+ * All pool functions must be called with SIGCHLD blocked.
+ */
+struct job_pool
+{
+    int max_running;    /* upper bound on concurrently running jobs */
+    int running;        /* number of slots currently in use */
+    struct job **slots; /* the job running in each slot, or NULL */
+    int *items;         /* the caller's number for the job in each slot */
+    int sigfd;          /* signalfd for SIGCHLD */
+    bool interrupted;   /* the user pressed ^C; the jobs were interrupted */
+};
+
+/* The most jobs a pool may run at once: the job list must hold them */
+#define JOB_POOL_MAX 4096
+
+static void
+job_pool_init(struct job_pool *pool, int max_running)
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+
+    pool->max_running = max_running;
+    pool->running = 0;
+    pool->slots = calloc(max_running, sizeof *pool->slots);
+    pool->items = calloc(max_running, sizeof *pool->items);
+    pool->sigfd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    pool->interrupted = false;
+}
+
+static void
+job_pool_destroy(struct job_pool *pool)
+{
+    assert(pool->running == 0);
+    close(pool->sigfd);
+    free(pool->slots);
+    free(pool->items);
+}
 
-    if (strcmp(argv[0], "kill") == 0)
+/* Start 'pipe' as a background job in a free slot of the pool, and
+ * remember 'item' for it.  Returns the slot number, or -1 with errno
+ * set if the job could not be started.
+ * The pipeline remains owned by the caller.
+ */
+static int
+job_pool_start(struct job_pool *pool, struct ast_pipeline *pipe, int outfd, int item)
+{
+    assert(pool->running < pool->max_running);
+
+    int slot = 0;
+    while (pool->slots[slot] != NULL)
+        slot++;
+
+    /* Without job control, as in a stage of a pipeline, the jobs stay
+     * in the caller's process group, so that ^C reaches them too */
+    pipe->bg_job = termstate_has_terminal();
+    struct job *job = add_job(pipe);
+    int rc = start_job(job, NULL, -1, outfd);
+    if (rc != 0)
     {
-        // kill
-        if (argc == 2)
-        {
-            // the job id for kill is obtained
-            int jidforKill = atoi(*(argv + 1));
+        remove_from_list(job);
+        errno = rc;
+        return -1;
+    }
 
-            // we can get the job from the corresponding id
-            struct job *killJob = get_job_from_jid(jidforKill);
+    pool->slots[slot] = job;
+    pool->items[slot] = item;
+    pool->running++;
+    return slot;
+}
 
-            if (killJob == NULL)
-            {
-                // If the job was not found, we will return the statement below.
-                printf("kill %d: no such job\n", jidforKill);
-            }
-            else
-            {
+/* Send 'sig' to a job of the pool.  Without job control, it has no
+ * process group of its own; as the pipelines of a pool have a single
+ * command, its process is signalled instead. */
+static void
+job_pool_signal(struct job *job, int sig)
+{
+    if (job->pipe->bg_job)
+        signal_job(job, sig);
+    else if (job->num_processes_alive > 0)
+        kill(job->pids[0], sig);
+}
 
-                // If the job was found, a signal can be set.
-                killpg(killJob->pgid, SIGTERM);
-            }
-        }
-        else
+/* Interrupt the pool's jobs after the user pressed ^C.  They run in
+ * the background, so the terminal did not send them the SIGINT. */
+static void
+job_pool_interrupt(struct job_pool *pool)
+{
+    pool->interrupted = true;
+    for (int i = 0; i < pool->max_running; i++)
+    {
+        if (pool->slots[i] != NULL && pool->slots[i]->status != DONE)
         {
-            printf("Incorrect number of arguments for the command 'kill'\n");
+            job_pool_signal(pool->slots[i], SIGINT);
+            job_pool_signal(pool->slots[i], SIGCONT);
         }
-        return 1;
     }
-    else if (strcmp(argv[0], "fg") == 0)
-    {
-        signal_block(SIGCHLD);
-        // fg
-        struct job *fgJob = NULL; // the job for fg
-        int jidforFg = 0;         // the job id for fg
+}
 
-        if (argc == 1)
-        {
-            printf("fg: job id missing\n");
-            return 1;
-        }
-        else if (argc == 2)
-        {
-            jidforFg = atoi(argv[1]);
-            fgJob = get_job_from_jid(jidforFg);
+/* Wait until one of the pool's jobs is done and return its slot.
+ * The shell sleeps in ppoll on the signalfd, which a ^C interrupts;
+ * SIGINT is blocked outside of it, so one that comes just before is
+ * not missed.  The jobs are then interrupted as well, and
+ * pool->interrupted tells the caller not to start more.  No one can
+ * continue a job that is stopped while the pool waits, so such a job
+ * is terminated. */
+static int
+job_pool_wait(struct job_pool *pool)
+{
+    assert(pool->running > 0);
 
-            if (fgJob == NULL)
+    sigset_t sigint, unblocked;
+    sigemptyset(&sigint);
+    sigaddset(&sigint, SIGINT);
+    sigprocmask(SIG_BLOCK, &sigint, &unblocked);
+    sigdelset(&unblocked, SIGINT);
+
+    for (;;)
+    {
+        for (int i = 0; i < pool->max_running; i++)
+        {
+            struct job *job = pool->slots[i];
+            if (job == NULL)
+                continue;
+            if (job->status == DONE)
             {
-                printf("fg: %d: No such job\n", jidforFg);
-                return 1;
+                sigprocmask(SIG_UNBLOCK, &sigint, NULL);
+                return i;
             }
-            if (fgJob->status == FOREGROUND)
+            if (job->status == STOPPED || job->status == NEEDSTERMINAL)
             {
-                printf("Job: %d is already running\n", jidforFg);
-                return 1;
+                job_pool_signal(job, SIGTERM);
+                job_pool_signal(job, SIGCONT);
+                job->status = BACKGROUND;
             }
         }
-        else
-        {
-            printf("Incorrect number of arguments for the command 'fg'\n");
-        }
-
-        struct ast_pipeline *pipe = fgJob->pipe;
-        command = list_entry(list_begin(&pipe->commands), struct ast_command, elem);
-        // The job was found
-        int status = killpg(fgJob->pgid, SIGCONT); // the signal we are available to use in the command fg
-                                                   // is SIGCONT
 
-        if (status == 0)
-        {
+        if (interrupted && !pool->interrupted)
+            job_pool_interrupt(pool);
 
-            termstate_give_terminal_to(NULL, fgJob->pgid);
-            fgJob->status = FOREGROUND; // the status of the job can be switched into FOREGROUND
-            print_job(fgJob);           // print the job
-            wait_for_job(fgJob);        // wait for the job to complete other processes
-            signal_unblock(SIGCHLD);
-            if (fgJob->status == FOREGROUND)
-            {
-                remove_from_list(fgJob);
-            }
-        }
-        else
+        struct pollfd pfd = {.fd = pool->sigfd, .events = POLLIN};
+        if (ppoll(&pfd, 1, NULL, &unblocked) == -1)
         {
-            printf("fg on job: %d was unsuccessful\n", jidforFg);
+            if (errno == EINTR)
+                continue;
+            utils_fatal_error("ppoll failed: ");
         }
-        termstate_give_terminal_back_to_shell();
-        return 1;
-    }
-    else if (strcmp(argv[0], "bg") == 0)
-    {
-        // bg
 
-        struct job *bgJob = NULL; // bgJob must be initialized
-        int jidforBg = 0;         // the job id for the command bg
+        struct signalfd_siginfo si;
+        while (read(pool->sigfd, &si, sizeof si) > 0)
+            continue;
 
-        if (argc == 1)
-        {
-            printf("bg: job id missing\n");
-            return 1;
-        }
-        else
-        {
-            jidforBg = atoi(argv[1]);
-            bgJob = get_job_from_jid(jidforBg);
+        int status;
+        pid_t child;
+        while ((child = waitpid(-1, &status, WUNTRACED | WNOHANG)) > 0)
+            handle_child_status(child, status);
+    }
+}
 
-            if (bgJob == NULL)
-            {
-                printf("bg %d: No such job\n", jidforBg);
-                return 1;
-            }
-            else if (bgJob->status != STOPPED)
-            {
-                printf("bg: %d is already in background\n", jidforBg);
-                return 1;
-            }
-        }
+/* Remove the job in 'slot' from the job list and return its pipeline.
+ * Its exit status is stored in '*status'. */
+static struct ast_pipeline *
+job_pool_release(struct job_pool *pool, int slot, int *status)
+{
+    struct job *job = pool->slots[slot];
+    struct ast_pipeline *pipe = job->pipe;
+
+    *status = job->exit_status;
+    remove_from_list(job);
+    pool->slots[slot] = NULL;
+    pool->running--;
+    return pipe;
+}
 
-        struct ast_pipeline *pipe = bgJob->pipe;
-        command = list_entry(list_begin(&pipe->commands), struct ast_command, elem);
-        int status = killpg(bgJob->pgid, SIGCONT); // Similar to what we
-                                                   // have done before,
-                                                   // the signal should
-                                                   // be set to SIGCONT;
-        if (status == 0)
-        {
-            // The signal is valid.
-            bgJob->status = BACKGROUND; // It enters the background stage.
-            signal_unblock(SIGCHLD);
-            print_job(bgJob);
-        }
-        else
-        {
-            printf("bg on job: %d was unsuccessful\n", jidforBg);
-        }
-        termstate_give_terminal_back_to_shell();
+/* Parse the number of jobs 'arg' given to 'cmd'; 0 is allowed, the
+ * caller decides what it means.  Returns false after an error message
+ * if it is not a number from 0 to JOB_POOL_MAX. */
+static bool
+parse_job_limit(const char *cmd, const char *arg, int *njobs)
+{
+    char *end;
+    errno = 0;
+    long n = strtol(arg, &end, 10);
+    if (errno != 0 || end == arg || *end != '\0' || n < 0 || n > JOB_POOL_MAX)
+    {
+        fprintf(stderr, "cush: %s: %s: invalid number of jobs (at most %d)\n", cmd, arg, JOB_POOL_MAX);
+        return false;
+    }
+    *njobs = n;
+    return true;
+}
+
+/* Return the number of jobs to run in parallel if the user didn't say. */
+static int
+default_parallelism(void)
+{
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return ncpus > 0 ? ncpus : 1;
+}
 
-        return 1;
+/* Return the length of 'word' with every {} replaced by 'item'. */
+static size_t
+parallel_word_length(const char *word, size_t itemlen, bool *substituted)
+{
+    size_t len = strlen(word);
+    for (const char *p = word; (p = strstr(p, "{}")) != NULL; p += 2)
+    {
+        len += itemlen - 2;
+        *substituted = true;
     }
-    else if (strcmp(argv[0], "jobs") == 0)
+    return len;
+}
+
+/* Build the argv of one parallel job by substituting 'item' for every
+ * occurrence of {} in the template words, or appending it if there is none.
+ * The array and the words are allocated as one block, so the argv can be
+ * freed together with its pipeline.
+ */
+static char **
+parallel_make_argv(char **template, int ntemplate, const char *item)
+{
+    size_t itemlen = strlen(item);
+    bool substituted = false;
+    size_t size = (ntemplate + 2) * sizeof(char *);
+    for (int i = 0; i < ntemplate; i++)
+        size += parallel_word_length(template[i], itemlen, &substituted) + 1;
+    if (!substituted)
+        size += itemlen + 1;
+
+    char **argv = malloc(size);
+    char *out = (char *)(argv + ntemplate + 2);
+    for (int i = 0; i < ntemplate; i++)
     {
-        // jobs
-        signal_block(SIGCHLD);
-        if (argc == 1)
+        argv[i] = out;
+        for (const char *p = template[i]; *p;)
         {
-            if (!list_empty(&job_list))
+            if (p[0] == '{' && p[1] == '}')
             {
-                for (struct list_elem *e = list_begin(&job_list);
-                     e != list_end(&job_list); e = list_next(e))
-                {
-                    // We basically use a for loop to keep track of each job in the
-                    // job list.
-                    struct job *currJob = list_entry(e, struct job, elem);
-
-                    if (currJob->status == DONE)
-                    {
-                        e = list_prev(e);
-                        remove_from_list(currJob);
-                    }
-                    else
-                    {
-                        print_job(currJob);
-                    }
-                }
+                out = mempcpy(out, item, itemlen);
+                p += 2;
             }
             else
             {
-                printf("There are currently no jobs in the job list.\n");
+                *out++ = *p++;
             }
         }
-        else
-        {
-            printf("Incorrect number of arguments for the command jobs\n");
-        }
-        return 1;
+        *out++ = '\0';
     }
-    else if (strcmp(argv[0], "stop") == 0)
-    {
-        // stop
-
-        if (argc == 2)
-        {
-            // It is similar to kill command above
+    argv[ntemplate] = NULL;
+    if (!substituted)
+        argv[ntemplate] = memcpy(out, item, itemlen + 1);
+    argv[ntemplate + 1] = NULL;
 
-            int jidforStop = atoi(argv[1]);                        // We may get the corresponding
-                                                                   // jid for the stop command
-            struct job *jobforStop = get_job_from_jid(jidforStop); // the job is
-                                                                   // obtained.
+    return argv;
+}
 
-            if (jobforStop == NULL)
-            {
-                printf("stop %d: No such job\n", jidforStop);
-            }
-            else
-            {
+/* Copy the output a parallel job left in 'fd' to our stdout and close it.
+ * If 'tag' is given, every line is prefixed with it.  Returns false, with
+ * errno set, if the output could not be written.
+ */
+static bool
+parallel_emit(int fd, const char *tag)
+{
+    bool ok = fflush(stdout) == 0;
 
-                struct ast_pipeline *pipe = jobforStop->pipe;
-                command = list_entry(list_begin(&pipe->commands), struct ast_command, elem);
-
-                killpg(jobforStop->pgid, SIGSTOP); // The signal can be
-                                                   // set as stop
-                // if (status == 0)
-                //{
-                //     jobforStop->status = STOPPED;                 // The status should
-                //  be regarded as stop
-                //    termstate_save(&jobforStop->saved_tty_state); // the state of
-                // terminal is saved.
-                //}
-                /*else
-                {
-                    printf("Stop on job: %d was unsuccessful\n", jidforStop);
-                }
-                */
-            }
-        }
-        else
-        {
-            printf("Incorrect number of arguments for command 'stop'\n");
-        }
-        return 1;
-    }
-    else if (strcmp(argv[0], "exit") == 0)
+    off_t size = lseek(fd, 0, SEEK_END);
+    off_t offset = 0;
+    if (size > 0 && tag == NULL)
     {
-        // exit
-        return 2;
-    }
-    else if (strcmp(argv[0], "cd") == 0)
-    {
-        if (argc == 1)
+        while (offset < size)
         {
-            chdir(getenv("HOME"));
+            ssize_t n = sendfile(STDOUT_FILENO, fd, &offset, size - offset);
+            if (n > 0)
+                continue;
+            if (n == -1 && errno == EINTR)
+                continue;
+            /* sendfile cannot write to a file opened O_APPEND, among
+             * others; those get the rest of the output copied */
+            if (n == -1 && (errno == EINVAL || errno == ENOSYS))
+                break;
+            ok = false;
+            break;
         }
-        else
+        char buf[8192];
+        while (ok && offset < size)
         {
-            if (chdir(argv[1]))
+            ssize_t n = pread(fd, buf, sizeof buf, offset);
+            if (n <= 0)
+                break;
+            for (ssize_t written = 0; written < n;)
             {
-                printf("cush: cd: %s: No such file or directory\n", argv[1]);
+                ssize_t w = write(STDOUT_FILENO, buf + written, n - written);
+                if (w == -1 && errno == EINTR)
+                    continue;
+                if (w <= 0)
+                {
+                    ok = false;
+                    break;
+                }
+                written += w;
             }
+            offset += n;
         }
-        return 1;
     }
-    else if (strcmp(argv[0], "history") == 0)
+    else if (size > 0)
     {
-        HIST_ENTRY **history = history_list();
-        for (int i = 0; i < history_length; i++)
+        char *buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (buf != MAP_FAILED)
         {
-            printf("    %d  %s\n", i, history[i]->line);
+            for (char *line = buf; line < buf + size;)
+            {
+                char *nl = memchr(line, '\n', buf + size - line);
+                char *end = nl ? nl + 1 : buf + size;
+                printf("%s\t%.*s%s", tag, (int)(end - line), line, nl ? "" : "\n");
+                line = end;
+            }
+            munmap(buf, size);
         }
-        return 1;
+        else
+            ok = false;
     }
-
-    return 0;
+    if (fflush(stdout) != 0)
+        ok = false;
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return ok;
 }
 
-static int isnum(char *cmd)
+/* Return the next item for 'parallel': from the list after ::: if there
+ * was one, or else the next line of standard input.  Returns NULL when
+ * the items are exhausted.
+ */
+static char *
+parallel_next_item(char ***items, char **linebuf, size_t *linecap)
 {
-    for (int i = 0; i < strlen(cmd); i++)
+    if (*items != NULL)
+        return **items ? *(*items)++ : NULL;
+
+    ssize_t len = getline(linebuf, linecap, stdin);
+    if (len == -1)
     {
-        if (!isdigit(cmd[i]))
-        {
-            return false;
-        }
+        clearerr(stdin);
+        return NULL;
     }
-    return true;
+    if (len > 0 && (*linebuf)[len - 1] == '\n')
+        (*linebuf)[len - 1] = '\0';
+    return *linebuf;
 }
 
-static char *run_hist(char *hist_cmd)
+/* The 'parallel' builtin.
+ *
+ *   parallel [-j N] [-k] [--tag] command [args...] [::: items...]
+ *
+ * Runs 'command' once per item, with {} in its arguments replaced by the
+ * item (or the item appended), keeping at most N jobs running at a time.
+ * N defaults to the number of online CPUs.  Without :::, items are read
+ * one per line from standard input.  Each job's output is collected and
+ * printed as a unit when the job finishes; -k prints the outputs in
+ * the order of the items instead, holding back at most 2N of them, and
+ * --tag prefixes every output line with its item.
+ *
+ * The status is the number of jobs that failed, at most 101, or 130
+ * if ^C interrupted the jobs.
+ */
+static int
+builtin_parallel(int argc, char **argv)
 {
-    if (strcmp(hist_cmd, "!!") == 0)
+    int njobs = default_parallelism();
+    bool keep_order = false;
+    bool tag = false;
+
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++)
     {
-        HIST_ENTRY *entry = history_get(history_length);
-        if (entry == NULL)
+        bool ok = true;
+        if (strcmp(argv[i], "-k") == 0)
+            keep_order = true;
+        else if (strcmp(argv[i], "--tag") == 0)
+            tag = true;
+        else if (strncmp(argv[i], "-j", 2) == 0 && argv[i][2] != '\0')
+            ok = parse_job_limit("parallel", argv[i] + 2, &njobs);
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            ok = parse_job_limit("parallel", argv[++i], &njobs);
+        else
+            break;
+        if (!ok)
         {
-            fprintf(stderr, "cush: %s: event not found\n", hist_cmd);
-            free(hist_cmd);
-            return NULL;
+            var_set_status(2);
+            return BUILTIN_DONE;
         }
-        free(hist_cmd);
-        printf("%s\n", entry->line);
-        return entry->line;
     }
-    else if (strncmp(hist_cmd, "!", 1) == 0)
+
+    char **template = argv + i;
+    int ntemplate = 0;
+    while (template[ntemplate] != NULL && strcmp(template[ntemplate], ":::") != 0)
+        ntemplate++;
+
+    if (ntemplate == 0 || njobs < 1)
     {
-        char *com = &hist_cmd[1];
-        if (isnum(com))
-        {
-            HIST_ENTRY *entry = history_get(atoi(com));
-            if (entry == NULL)
-            {
-                fprintf(stderr, "cush: %s: event not found\n", hist_cmd);
-                free(hist_cmd);
-                return NULL;
-            }
-            free(hist_cmd);
-            printf("%s\n", entry->line);
-            return entry->line;
-        }
-        else
-        {
-            for (int i = history_length - 1; i >= 0; i--)
-            {
-                HIST_ENTRY *entry = history_get(i);
-                if (entry == NULL)
+        fprintf(stderr, "usage: parallel [-j N] [-k] [--tag] command [args...] [::: items...]\n");
+        var_set_status(2);
+        return BUILTIN_DONE;
+    }
+
+    char **items = template[ntemplate] ? template + ntemplate + 1 : NULL;
+    char *linebuf = NULL;
+    size_t linecap = 0;
+
+    /* The output of every item, held until it can be printed. */
+    struct parallel_output
+    {
+        int fd;    /* memfd the job wrote to, -1 if there is none */
+        char *tag; /* line prefix for --tag, or NULL */
+        bool done; /* true once the job finished */
+    } *outputs = NULL;
+    int nitems = 0, next_to_emit = 0, nfailed = 0;
+    bool write_failed = false;
+
+    struct job_pool pool;
+    job_pool_init(&pool, njobs);
+
+    signal_block(SIGCHLD);
+    bool more_items = true;
+    while ((more_items && !pool.interrupted) || pool.running > 0)
+    {
+        /* With -k, the outputs held for later items are bounded too, so
+         * that a slow item does not leave one memfd open per item after it */
+        while (more_items && !pool.interrupted && pool.running < njobs
+               && (!keep_order || nitems - next_to_emit < 2 * njobs))
+        {
+            char *item = parallel_next_item(&items, &linebuf, &linecap);
+            if (item == NULL)
+            {
+                more_items = false;
+                break;
+            }
+
+            char **argv = parallel_make_argv(template, ntemplate, item);
+            struct ast_pipeline *pipe = ast_pipeline_create(argv, "/dev/null", NULL, false);
+
+            outputs = realloc(outputs, (nitems + 1) * sizeof *outputs);
+            struct parallel_output *out = &outputs[nitems];
+            out->fd = memfd_create("parallel", MFD_CLOEXEC);
+            out->tag = tag ? strdup(item) : NULL;
+            out->done = false;
+
+            if (job_pool_start(&pool, pipe, out->fd, nitems) == -1)
+            {
+                ast_pipeline_free(pipe);
+                out->done = true;
+                nfailed++;
+            }
+            nitems++;
+        }
+
+        if (pool.running > 0)
+        {
+            int slot = job_pool_wait(&pool), status;
+            int item = pool.items[slot];
+            ast_pipeline_free(job_pool_release(&pool, slot, &status));
+            outputs[item].done = true;
+            if (status != 0)
+                nfailed++;
+        }
+
+        /* Print finished outputs, but never ahead of an earlier item if
+         * the order is to be kept. */
+        for (int j = next_to_emit; j < nitems; j++)
+        {
+            struct parallel_output *out = &outputs[j];
+            if (!out->done)
+            {
+                if (keep_order)
+                    break;
+                continue;
+            }
+            if (out->fd != -1 && !parallel_emit(out->fd, out->tag) && !write_failed)
+            {
+                fprintf(stderr, "cush: parallel: write error: %s\n", strerror(errno));
+                write_failed = true;
+            }
+            free(out->tag);
+            out->fd = -1;
+            out->tag = NULL;
+            if (j == next_to_emit)
+                next_to_emit++;
+        }
+    }
+    signal_unblock(SIGCHLD);
+
+    job_pool_destroy(&pool);
+    free(outputs);
+    free(linebuf);
+    if (pool.interrupted)
+        var_set_status(130);
+    else if (nfailed > 0)
+        var_set_status(nfailed < 101 ? nfailed : 101);
+    else if (write_failed)
+        var_set_status(1);
+    return BUILTIN_DONE;
+}
+
+/* Copy 'argv' into one block holding both the array and the words,
+ * so that freeing the array, as ast_pipeline_free does, frees all of it. */
+static char **
+argv_copy(char **argv)
+{
+    int argc = 0;
+    size_t size = sizeof(char *);
+    for (; argv[argc]; argc++)
+        size += sizeof(char *) + strlen(argv[argc]) + 1;
+
+    char **copy = malloc(size);
+    char *words = (char *)(copy + argc + 1);
+    for (int i = 0; i < argc; i++)
+    {
+        copy[i] = words;
+        words = stpcpy(words, argv[i]) + 1;
+    }
+    copy[argc] = NULL;
+    return copy;
+}
+
+/* Set the variable NAME<suffix> that describes a coprocess. */
+static void
+coproc_setenv(const char *name, const char *suffix, const char *fmt, int value)
+{
+    char var[strlen(name) + strlen(suffix) + 1];
+    char val[32];
+    snprintf(var, sizeof var, "%s%s", name, suffix);
+    snprintf(val, sizeof val, fmt, value);
+    setenv(var, val, 1);
+}
+
+/* The 'coproc' builtin.
+ *
+ *   coproc NAME command [args...]
+ *   coproc
+ *
+ * Starts 'command' as a background job whose standard input and output
+ * are pipes held open by the shell, so a long-lived filter can serve many
+ * later commands.  The pipes are advertised as NAME_IN (write to the
+ * coprocess) and NAME_OUT (read from it) in the form /dev/fd/N, which later
+ * commands can redirect to and from; NAME_PID holds the process id.  The
+ * job is tracked in the job list like any other and its pipes are closed
+ * when it is removed.  Without arguments, lists the active coprocesses.
+ */
+static int
+builtin_coproc(int argc, char **argv)
+{
+    if (argc == 1)
+    {
+        for (struct list_elem *e = list_begin(&job_list); e != list_end(&job_list); e = list_next(e))
+        {
+            struct job *job = list_entry(e, struct job, elem);
+            if (job->coproc_name)
+                printf("[%d]\t%s\t%d\tin /dev/fd/%d\tout /dev/fd/%d\n", job->jid, job->coproc_name,
+                       job->pgid, job->coproc_in, job->coproc_out);
+        }
+        return BUILTIN_DONE;
+    }
+    if (argc < 3)
+    {
+        printf("usage: coproc NAME command [args...]\n");
+        return BUILTIN_DONE;
+    }
+
+    signal_block(SIGCHLD);
+    for (struct list_elem *e = list_begin(&job_list); e != list_end(&job_list); e = list_next(e))
+    {
+        struct job *job = list_entry(e, struct job, elem);
+        if (job->coproc_name && job->status != DONE && strcmp(job->coproc_name, argv[1]) == 0)
+        {
+            printf("coproc: %s: already running as job %d\n", argv[1], job->jid);
+            signal_unblock(SIGCHLD);
+            return BUILTIN_DONE;
+        }
+    }
+
+    int to_child[2], from_child[2];
+    if (pipe2(to_child, O_CLOEXEC) == -1)
+    {
+        utils_error("coproc: pipe: ");
+        signal_unblock(SIGCHLD);
+        return BUILTIN_DONE;
+    }
+    if (pipe2(from_child, O_CLOEXEC) == -1)
+    {
+        utils_error("coproc: pipe: ");
+        close(to_child[0]);
+        close(to_child[1]);
+        signal_unblock(SIGCHLD);
+        return BUILTIN_DONE;
+    }
+
+    struct ast_pipeline *pipe = ast_pipeline_create(argv_copy(argv + 2), NULL, NULL, false);
+    pipe->bg_job = true;
+
+    struct job *job = add_job(pipe);
+    int rc = start_job(job, NULL, to_child[0], from_child[1]);
+    close(to_child[0]);
+    close(from_child[1]);
+
+    if (rc != 0)
+    {
+        remove_from_list(job);
+        ast_pipeline_free(pipe);
+        close(to_child[1]);
+        close(from_child[0]);
+        signal_unblock(SIGCHLD);
+        return BUILTIN_DONE;
+    }
+
+    job->coproc_name = strdup(argv[1]);
+    job->coproc_in = to_child[1];
+    job->coproc_out = from_child[0];
+    coproc_setenv(argv[1], "_IN", "/dev/fd/%d", job->coproc_in);
+    coproc_setenv(argv[1], "_OUT", "/dev/fd/%d", job->coproc_out);
+    coproc_setenv(argv[1], "_PID", "%d", job->pgid);
+
+    printf("[%d] %d\n", job->jid, job->pgid);
+    signal_unblock(SIGCHLD);
+    return BUILTIN_DONE;
+}
+
+/* Read all of the file open on 'fd' into memory, followed by a NUL byte.
+ * Regular files are mapped, anything else (pipes, terminals) is read
+ * into a buffer that doubles in size as needed.  Sets *mapped to tell
+ * the caller how to release the data.  Returns NULL on error.
+ */
+static char *
+xargs_read_input(int fd, size_t *size, bool *mapped)
+{
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+    {
+        *mapped = true;
+        return utils_map_file(fd, size);
+    }
+
+    *mapped = false;
+    size_t cap = 1 << 16;
+    char *buf = malloc(cap);
+    *size = 0;
+    for (;;)
+    {
+        if (cap - *size < 2)
+            buf = realloc(buf, cap *= 2);
+
+        ssize_t n = read(fd, buf + *size, cap - *size - 1);
+        if (n == 0)
+            break;
+        if (n == -1)
+        {
+            free(buf);
+            return NULL;
+        }
+        *size += n;
+    }
+    buf[*size] = '\0';
+    return buf;
+}
+
+/* Return the number of bytes available for the arguments of a command,
+ * after accounting for the environment it will be given.
+ */
+static size_t
+xargs_arg_space(void)
+{
+    long argmax = sysconf(_SC_ARG_MAX);
+    size_t space = argmax > 0 ? argmax : _POSIX_ARG_MAX;
+
+    for (char **e = environ; *e; e++)
+        space -= strlen(*e) + 1 + sizeof(char *);
+
+    /* leave some headroom, as POSIX asks xargs to do */
+    return space > 4096 ? space - 2048 : space / 2;
+}
+
+/* The 'xargs' builtin.
+ *
+ *   xargs [-P N] [-n max] [-0] [-a file] [command [args...]]
+ *
+ * Reads items separated by blanks and newlines (or by NUL bytes with -0)
+ * from standard input or 'file' and runs 'command' (default: echo) with
+ * as many items appended as fit into the system's argument space, or at
+ * most 'max' per command.  With -P, up to N batches run concurrently
+ * through a job pool; -P 0 uses one per online CPU.
+ *
+ * As POSIX asks, the status is 123 if a command exited with a status
+ * from 1 to 128, 124 if one exited with 255, 125 if one was killed by
+ * a signal, 126 if the command could not be run and 127 if it was not
+ * found; after the last four, no more commands are started.
+ *
+ * The input is held in one buffer in which the items are terminated in
+ * place, so a batch's argv is a single array of pointers into that buffer
+ * and no memory is allocated per item.
+ */
+static int
+builtin_xargs(int argc, char **argv)
+{
+    int njobs = 1;
+    long maxargs = 0;
+    bool nul_separated = false;
+    char *input_file = NULL;
+
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++)
+    {
+        if (strcmp(argv[i], "-0") == 0)
+        {
+            nul_separated = true;
+            continue;
+        }
+
+        /* The value of -P, -n and -a may be attached, as in -n1 */
+        char opt = argv[i][1];
+        if (strchr("Pna", opt) == NULL || (argv[i][2] == '\0' && i + 1 == argc))
+        {
+            fprintf(stderr, "usage: xargs [-P N] [-n max] [-0] [-a file] [command [args...]]\n");
+            var_set_status(1);
+            return BUILTIN_DONE;
+        }
+        char *value = argv[i][2] != '\0' ? argv[i] + 2 : argv[++i];
+
+        char *end;
+        if (opt == 'P' && !parse_job_limit("xargs", value, &njobs))
+        {
+            var_set_status(1);
+            return BUILTIN_DONE;
+        }
+        else if (opt == 'n' && ((maxargs = strtol(value, &end, 10)) < 1 || *end != '\0'))
+        {
+            fprintf(stderr, "cush: xargs: %s: invalid number of arguments\n", value);
+            var_set_status(1);
+            return BUILTIN_DONE;
+        }
+        else if (opt == 'a')
+            input_file = value;
+    }
+    if (njobs == 0)
+        njobs = default_parallelism();
+
+    static char *default_command[] = {"echo", NULL};
+    char **template = i < argc ? argv + i : default_command;
+    int ntemplate = 0;
+    while (template[ntemplate] != NULL)
+        ntemplate++;
+
+    int fd = STDIN_FILENO;
+    if (input_file && (fd = open(input_file, O_RDONLY | O_CLOEXEC)) == -1)
+    {
+        utils_error("xargs: %s: ", input_file);
+        var_set_status(1);
+        return BUILTIN_DONE;
+    }
+
+    size_t size;
+    bool mapped;
+    char *input = xargs_read_input(fd, &size, &mapped);
+    if (fd != STDIN_FILENO)
+        close(fd);
+    if (input == NULL)
+    {
+        utils_error("xargs: cannot read input: ");
+        var_set_status(1);
+        return BUILTIN_DONE;
+    }
+
+    size_t space = xargs_arg_space();
+    size_t template_size = 0;
+    for (int j = 0; j < ntemplate; j++)
+        template_size += strlen(template[j]) + 1 + sizeof(char *);
+
+    const char *separators = nul_separated ? "" : " \t\n";
+    char *next = input, *end = input + size;
+
+    struct job_pool pool;
+    job_pool_init(&pool, njobs > 0 ? njobs : 1);
+
+    signal_block(SIGCHLD);
+    bool more_items = true;
+    int status = 0;
+    while ((more_items && !pool.interrupted) || pool.running > 0)
+    {
+        while (more_items && !pool.interrupted && pool.running < pool.max_running)
+        {
+            /* Build the next batch: the template followed by as many items
+             * as fit.  Items are terminated in place in the input buffer. */
+            size_t cap = ntemplate + 64, nargs = ntemplate;
+            char **batch = malloc(cap * sizeof *batch);
+            memcpy(batch, template, ntemplate * sizeof *batch);
+
+            size_t used = template_size;
+            for (;;)
+            {
+                while (next < end && (*next == '\0' || strchr(separators, *next)))
+                    next++;
+                if (next >= end)
                 {
+                    more_items = false;
                     break;
                 }
-                if (strncmp(com, entry->line, strlen(com)) == 0)
+
+                char *item_end = next;
+                while (item_end < end && *item_end != '\0' && !strchr(separators, *item_end))
+                    item_end++;
+
+                size_t cost = item_end - next + 1 + sizeof(char *);
+                if (nargs > ntemplate && (used + cost > space || (maxargs && nargs - ntemplate >= maxargs)))
+                    break;
+
+                *item_end = '\0';
+                if (nargs + 1 == cap)
+                    batch = realloc(batch, (cap *= 2) * sizeof *batch);
+                batch[nargs++] = next;
+                used += cost;
+                next = item_end + 1;
+            }
+            batch[nargs] = NULL;
+
+            if (nargs == ntemplate)
+            {
+                free(batch);
+                break;
+            }
+
+            struct ast_pipeline *pipe = ast_pipeline_create(batch, "/dev/null", NULL, false);
+            if (job_pool_start(&pool, pipe, -1, 0) == -1)
+            {
+                status = errno == ENOENT ? 127 : 126;
+                more_items = false;
+                ast_pipeline_free(pipe);
+            }
+        }
+
+        if (pool.running > 0)
+        {
+            int exit_status;
+            ast_pipeline_free(job_pool_release(&pool, job_pool_wait(&pool), &exit_status));
+            if (exit_status == 255 || (exit_status > 128 && !pool.interrupted))
+            {
+                status = exit_status == 255 ? 124 : 125;
+                more_items = false;
+            }
+            else if (exit_status != 0 && status == 0)
+                status = 123;
+        }
+    }
+    signal_unblock(SIGCHLD);
+    var_set_status(pool.interrupted ? 130 : status);
+
+    job_pool_destroy(&pool);
+    if (mapped)
+        utils_unmap_file(input, size);
+    else
+        free(input);
+    return BUILTIN_DONE;
+}
+
+/* Show how often command lines were found in the parsed-AST cache.
+ * With -c, the cache is emptied. */
+static int
+builtin_astcache(int argc, char **argv)
+{
+    if (argc == 2 && strcmp(argv[1], "-c") == 0)
+    {
+        ast_cache_clear();
+        return BUILTIN_DONE;
+    }
+    if (argc != 1)
+    {
+        printf("usage: astcache [-c]\n");
+        return BUILTIN_DONE;
+    }
+
+    struct ast_cache_stats stats;
+    ast_cache_get_stats(&stats);
+    unsigned long lookups = stats.hits + stats.misses;
+    printf("hits %lu misses %lu (%.1f%% hit rate), %d/%d entries, %lu evicted\n",
+           stats.hits, stats.misses, lookups ? 100.0 * stats.hits / lookups : 0.0,
+           stats.entries, stats.capacity, stats.evictions);
+    return BUILTIN_DONE;
+}
+
+/* Set shell variables from words of the form NAME=value.
+ * Assignments before a command name are not supported. */
+static int
+builtin_assign(int argc, char **argv)
+{
+    for (int i = 0; i < argc; i++)
+    {
+        if (var_assignment(argv[i]) == NULL)
+        {
+            fprintf(stderr, "cush: %s: assignments before a command are not supported\n", argv[i]);
+            var_set_status(1);
+            return BUILTIN_DONE;
+        }
+    }
+    for (int i = 0; i < argc; i++)
+    {
+        char *eq = var_assignment(argv[i]);
+        char name[eq - argv[i] + 1];
+        memcpy(name, argv[i], eq - argv[i]);
+        name[eq - argv[i]] = '\0';
+        var_set(name, eq + 1);
+    }
+    return BUILTIN_DONE;
+}
+
+/* Export NAME or NAME=value to the environment of commands.
+ * Without arguments, list the environment. */
+static int
+builtin_export(int argc, char **argv)
+{
+    extern char **environ;
+    if (argc == 1)
+    {
+        for (char **e = environ; *e; e++)
+            printf("export %s\n", *e);
+        return BUILTIN_DONE;
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        char *eq = var_assignment(argv[i]);
+        if (eq)
+        {
+            *eq = '\0';
+            var_export(argv[i]);    /* moves a shell variable to the environment */
+            setenv(argv[i], eq + 1, 1);
+            *eq = '=';
+        }
+        else if (var_valid_name(argv[i], strlen(argv[i])))
+        {
+            var_export(argv[i]);
+        }
+        else
+        {
+            fprintf(stderr, "cush: export: `%s': not a valid identifier\n", argv[i]);
+            var_set_status(1);
+        }
+    }
+    return BUILTIN_DONE;
+}
+
+/* Remove variables from the shell and the environment */
+static int
+builtin_unset(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+        var_unset(argv[i]);
+    return BUILTIN_DONE;
+}
+
+/* Return the current job, %+, or the previous one, %-, if 'previous';
+ * NULL if there is none */
+static struct job *
+current_job(bool previous)
+{
+    struct job *current = NULL, *before = NULL;
+    for (struct list_elem *e = list_begin(&job_list); e != list_end(&job_list); e = list_next(e))
+    {
+        struct job *job = list_entry(e, struct job, elem);
+        if (job->status == DONE)
+            continue;
+        if (current == NULL || job->last_active > current->last_active)
+        {
+            before = current;
+            current = job;
+        }
+        else if (before == NULL || job->last_active > before->last_active)
+        {
+            before = job;
+        }
+    }
+    return previous ? before : current;
+}
+
+/* Add 'job' to the 'n' jobs in 'jobs', unless it is there already */
+static void
+add_to_jobs(struct job *job, struct job **jobs, int *n)
+{
+    for (int i = 0; i < *n; i++)
+        if (jobs[i] == job)
+            return;
+    jobs[(*n)++] = job;
+}
+
+/* Add the jobs 'spec' names to the 'n' jobs in 'jobs'.  A spec is a
+ * list, separated by commas, of jids N or %N, ranges N-M or %N-%M,
+ * the current job %+ (or %% or %) and the previous job %-.  Jobs that
+ * are done but not yet reported are only named by jid, if 'done'.
+ * Returns false after reporting a part of the list that names no job. */
+static bool
+add_job_spec(const char *cmd, const char *spec, struct job **jobs, int *n, bool done)
+{
+    for (const char *p = spec;; p++)
+    {
+        const char *end = strchrnul(p, ',');
+        char item[end - p + 1];
+        memcpy(item, p, end - p);
+        item[end - p] = '\0';
+
+        int found = 0;
+        struct job *job = NULL;
+        if (strcmp(item, "%") == 0 || strcmp(item, "%%") == 0 || strcmp(item, "%+") == 0)
+            job = current_job(false);
+        else if (strcmp(item, "%-") == 0)
+            job = current_job(true);
+        else
+        {
+            char *q = item + (item[0] == '%');
+            long first = strtol(q, &q, 10), last = first;
+            if (*q == '-')
+            {
+                q += 1 + (q[1] == '%');
+                last = strtol(q, &q, 10);
+            }
+            if (*q != '\0' || q == item)
+                first = 1, last = 0;    /* not a spec: an empty range */
+            for (long jid = first > 0 ? first : 1; jid <= last && jid < MAXJOBS; jid++)
+            {
+                if ((job = get_job_from_jid(jid)) != NULL && (done || job->status != DONE))
                 {
-                    free(hist_cmd);
-                    printf("%s\n", entry->line);
-                    return entry->line;
+                    add_to_jobs(job, jobs, n);
+                    found++;
                 }
             }
-            fprintf(stderr, "cush: %s: event not found\n", hist_cmd);
-            free(hist_cmd);
-            return NULL;
+            job = NULL;
+        }
+        if (job)
+        {
+            add_to_jobs(job, jobs, n);
+            found++;
+        }
+        if (found == 0)
+        {
+            fprintf(stderr, "cush: %s: %s: no such job\n", cmd, item);
+            return false;
+        }
+        if (*end == '\0')
+            return true;
+        p = end;
+    }
+}
+
+/* Collect the jobs that arguments 'first' and on of 'argv' name in
+ * 'jobs', which has room for every job; -a stands for all jobs.
+ * Without arguments, the current job is taken if 'current', else an
+ * error reported.  Returns the number of jobs, or -1 after an error,
+ * for which the status is set. */
+static int
+collect_jobs(const char *cmd, int argc, char **argv, int first, struct job **jobs, bool current)
+{
+    int n = 0;
+    if (argc > first && strcmp(argv[first], "-a") == 0)
+    {
+        for (struct list_elem *e = list_begin(&job_list); e != list_end(&job_list); e = list_next(e))
+        {
+            struct job *job = list_entry(e, struct job, elem);
+            if (job->status != DONE)
+                jobs[n++] = job;
+        }
+        return n;
+    }
+    if (argc == first)
+    {
+        struct job *job = current ? current_job(false) : NULL;
+        if (job)
+        {
+            jobs[0] = job;
+            return 1;
+        }
+        fprintf(stderr, current ? "cush: %s: no current job\n" : "cush: %s: job id missing\n", cmd);
+        var_set_status(1);
+        return -1;
+    }
+    for (int i = first; i < argc; i++)
+    {
+        if (!add_job_spec(cmd, argv[i], jobs, &n, false))
+        {
+            var_set_status(1);
+            return -1;
+        }
+    }
+    return n;
+}
+
+/* Return the number of signal 'name', a number or a name with or
+ * without SIG in any case, or -1 if there is no such signal */
+static int
+signal_number(const char *name)
+{
+    if (isdigit((unsigned char) *name))
+    {
+        char *end;
+        long sig = strtol(name, &end, 10);
+        return *end == '\0' && sig < NSIG ? sig : -1;
+    }
+    if (strncasecmp(name, "SIG", 3) == 0)
+        name += 3;
+    for (int sig = 1; sig < NSIG; sig++)
+    {
+        const char *abbrev = sigabbrev_np(sig);
+        if (abbrev && strcasecmp(abbrev, name) == 0)
+            return sig;
+    }
+    return -1;
+}
+
+/* kill [-s SIG | -SIG] [-a | job...] sends a signal, SIGTERM unless
+ * another is given, to the jobs; kill -l lists the signals */
+static int
+builtin_kill(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "-l") == 0)
+    {
+        for (int sig = 1; sig < NSIG; sig++)
+            if (sigabbrev_np(sig))
+                printf("%2d) SIG%s\n", sig, sigabbrev_np(sig));
+        return BUILTIN_DONE;
+    }
+
+    int sig = SIGTERM, first = 1;
+    if (argc > 2 && (strcmp(argv[1], "-s") == 0 || strcmp(argv[1], "-n") == 0))
+    {
+        sig = signal_number(argv[2]);
+        first = 3;
+    }
+    else if (argc > 1 && argv[1][0] == '-' && strcmp(argv[1], "-a") != 0)
+    {
+        sig = signal_number(argv[1] + 1);
+        first = 2;
+    }
+    if (sig == -1)
+    {
+        fprintf(stderr, "cush: kill: %s: invalid signal specification\n", argv[first - 1]);
+        var_set_status(1);
+        return BUILTIN_DONE;
+    }
+
+    signal_block(SIGCHLD);
+    struct job *jobs[list_size(&job_list) + 1];
+    int n = collect_jobs("kill", argc, argv, first, jobs, false);
+    for (int i = 0; i < n; i++)
+    {
+        if (signal_job(jobs[i], sig) == -1)
+        {
+            fprintf(stderr, "cush: kill: %d: %s\n", jobs[i]->jid, strerror(errno));
+            var_set_status(1);
+        }
+        else if (sig == SIGCONT && jobs[i]->status == STOPPED)
+        {
+            jobs[i]->status = BACKGROUND;
+            jobs[i]->last_active = ++job_clock;
+        }
+    }
+    signal_unblock(SIGCHLD);
+    return BUILTIN_DONE;
+}
+
+/* fg [job] continues a job, the current one unless another is given,
+ * in the foreground, and waits for it */
+static int
+builtin_fg(int argc, char **argv)
+{
+    signal_block(SIGCHLD);
+    struct job *jobs[list_size(&job_list) + 1];
+    int n = collect_jobs("fg", argc, argv, 1, jobs, true);
+    if (n != 1)
+    {
+        if (n > 1)
+        {
+            fprintf(stderr, "cush: fg: only one job can be in the foreground\n");
+            var_set_status(1);
+        }
+        signal_unblock(SIGCHLD);
+        return BUILTIN_DONE;
+    }
+
+    struct job *fgJob = jobs[0]; // the job for fg
+    if (fgJob->status == FOREGROUND)
+    {
+        printf("Job: %d is already running\n", fgJob->jid);
+        signal_unblock(SIGCHLD);
+        return BUILTIN_DONE;
+    }
+
+    // The job was found
+    int status = signal_job(fgJob, SIGCONT); // the signal we are available to use in the command fg
+                                             // is SIGCONT
+
+    if (status == 0)
+    {
+
+        termstate_give_terminal_to(NULL, fgJob->pgid);
+        fgJob->status = FOREGROUND; // the status of the job can be switched into FOREGROUND
+        print_job(fgJob);           // print the job
+        wait_for_job(fgJob);        // wait for the job to complete other processes
+        signal_unblock(SIGCHLD);
+        if (fgJob->status == FOREGROUND)
+        {
+            remove_from_list(fgJob);
+        }
+    }
+    else
+    {
+        printf("fg on job: %d was unsuccessful\n", fgJob->jid);
+        signal_unblock(SIGCHLD);
+    }
+    termstate_give_terminal_back_to_shell();
+    return BUILTIN_DONE;
+}
+
+/* bg [-a | job...] continues stopped jobs, the current one unless
+ * others are given, in the background */
+static int
+builtin_bg(int argc, char **argv)
+{
+    signal_block(SIGCHLD);
+    struct job *jobs[list_size(&job_list) + 1];
+    int n = collect_jobs("bg", argc, argv, 1, jobs, true);
+    bool all = argc > 1 && strcmp(argv[1], "-a") == 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        struct job *bgJob = jobs[i];
+        if (bgJob->status != STOPPED)
+        {
+            // With -a, only the jobs that are stopped are meant
+            if (!all)
+                printf("bg: %d is already in background\n", bgJob->jid);
+            continue;
+        }
+
+        if (signal_job(bgJob, SIGCONT) == 0)
+        {
+            // The signal is valid.
+            bgJob->status = BACKGROUND; // It enters the background stage.
+            bgJob->last_active = ++job_clock;
+            print_job(bgJob);
+        }
+        else
+        {
+            printf("bg on job: %d was unsuccessful\n", bgJob->jid);
+        }
+    }
+    signal_unblock(SIGCHLD);
+    termstate_give_terminal_back_to_shell();
+
+    return BUILTIN_DONE;
+}
+
+static int
+builtin_jobs(int argc, char **argv)
+{
+    // jobs
+    signal_block(SIGCHLD);
+    if (argc == 1)
+    {
+        if (!list_empty(&job_list))
+        {
+            for (struct list_elem *e = list_begin(&job_list);
+                 e != list_end(&job_list); e = list_next(e))
+            {
+                // We basically use a for loop to keep track of each job in the
+                // job list.
+                struct job *currJob = list_entry(e, struct job, elem);
+
+                if (currJob->status == DONE)
+                {
+                    e = list_prev(e);
+                    remove_from_list(currJob);
+                }
+                else
+                {
+                    print_job(currJob);
+                }
+            }
+        }
+        else
+        {
+            printf("There are currently no jobs in the job list.\n");
+        }
+    }
+    else
+    {
+        printf("Incorrect number of arguments for the command jobs\n");
+    }
+    return BUILTIN_DONE;
+}
+
+/* stop [-a | job...] stops the jobs with SIGSTOP */
+static int
+builtin_stop(int argc, char **argv)
+{
+    signal_block(SIGCHLD);
+    struct job *jobs[list_size(&job_list) + 1];
+    int n = collect_jobs("stop", argc, argv, 1, jobs, false);
+    for (int i = 0; i < n; i++)
+    {
+        // The job is marked stopped once the SIGCHLD handler learns
+        // that it is.
+        if (signal_job(jobs[i], SIGSTOP) == -1)
+        {
+            fprintf(stderr, "cush: stop: %d: %s\n", jobs[i]->jid, strerror(errno));
+            var_set_status(1);
+        }
+    }
+    signal_unblock(SIGCHLD);
+    return BUILTIN_DONE;
+}
+
+static int
+builtin_exit(int argc, char **argv)
+{
+    // exit, with status 0 unless one is given
+    if (argc > 1)
+        var_set_status(atoi(argv[1]) & 0xff);
+    return BUILTIN_EXIT;
+}
+
+static int
+builtin_cd(int argc, char **argv)
+{
+    if (argc == 1)
+    {
+        chdir(getenv("HOME"));
+    }
+    else
+    {
+        if (chdir(argv[1]))
+        {
+            printf("cush: cd: %s: No such file or directory\n", argv[1]);
+        }
+    }
+    return BUILTIN_DONE;
+}
+
+static int
+builtin_history(int argc, char **argv)
+{
+    // Entries are printed with the numbers !N refers to, and with the
+    // time they were added if HISTTIMEFORMAT is set, as in bash.
+    const char *format = getenv("HISTTIMEFORMAT");
+    hist_sync();
+    for (int n = hist_first(); n <= hist_last(); n++)
+    {
+        char when[256] = "";
+        if (format)
+        {
+            time_t t = hist_time(n);
+            strftime(when, sizeof when, format, localtime(&t));
+        }
+        printf("    %d  %s%s\n", n, when, hist_get(n));
+    }
+    return BUILTIN_DONE;
+}
+
+/* Define aliases, or print them */
+static int
+builtin_alias(int argc, char **argv)
+{
+    if (argc == 1)
+        command_print_aliases(stdout);
+
+    for (int i = 1; i < argc; i++)
+    {
+        char *eq = strchr(argv[i], '=');
+        struct command *cmd = command_lookup(argv[i]);
+        if (eq)
+        {
+            *eq = '\0';
+            command_set_alias(argv[i], eq + 1);
+            *eq = '=';
+        }
+        else if (cmd && cmd->alias)
+        {
+            printf("alias %s='%s'\n", cmd->name, cmd->alias);
+        }
+        else
+        {
+            fprintf(stderr, "cush: alias: %s: not found\n", argv[i]);
+            var_set_status(1);
+        }
+    }
+    return BUILTIN_DONE;
+}
+
+static int
+builtin_unalias(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (!command_set_alias(argv[i], NULL))
+        {
+            fprintf(stderr, "cush: unalias: %s: not found\n", argv[i]);
+            var_set_status(1);
+        }
+    }
+    return BUILTIN_DONE;
+}
+
+/* hash -r forgets the locations of all programs; hash name... looks
+ * them up and remembers them */
+static int
+builtin_hash(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-r") == 0)
+        {
+            command_forget_paths(NULL);
+        }
+        else if (command_path(argv[i]) == NULL)
+        {
+            fprintf(stderr, "cush: hash: %s: not found\n", argv[i]);
+            var_set_status(1);
+        }
+    }
+    return BUILTIN_DONE;
+}
+
+/* Tell how each name would be resolved as a command */
+static int
+builtin_type(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        struct command *cmd = command_lookup(argv[i]);
+        const char *path;
+        if (cmd && cmd->function)
+            printf("%s is a function\n", argv[i]);
+        else if (cmd && cmd->alias)
+            printf("%s is aliased to `%s'\n", argv[i], cmd->alias);
+        else if (builtin_lookup(argv[i]))
+            printf("%s is a shell builtin\n", argv[i]);
+        else if ((path = command_path(argv[i])) != NULL)
+            printf("%s is %s\n", argv[i], path);
+        else
+        {
+            fprintf(stderr, "cush: type: %s: not found\n", argv[i]);
+            var_set_status(1);
+        }
+    }
+    return BUILTIN_DONE;
+}
+
+/* The job table as plugins see it; see struct cush_shell */
+static int
+plugin_next_job(int jid)
+{
+    bool blocked = signal_block(SIGCHLD);
+    int next = 0;
+    for (struct list_elem *e = list_begin(&job_list); e != list_end(&job_list); e = list_next(e))
+    {
+        struct job *job = list_entry(e, struct job, elem);
+        if (job->jid > jid && (next == 0 || job->jid < next))
+            next = job->jid;
+    }
+    if (!blocked)
+        signal_unblock(SIGCHLD);
+    return next;
+}
+
+static int
+plugin_get_job(int jid, struct cush_job *info)
+{
+    bool blocked = signal_block(SIGCHLD);
+    struct job *job = get_job_from_jid(jid);
+    if (job)
+    {
+        static const int states[] = {
+            [FOREGROUND] = CUSH_JOB_FOREGROUND, [BACKGROUND] = CUSH_JOB_RUNNING,
+            [STOPPED] = CUSH_JOB_STOPPED, [NEEDSTERMINAL] = CUSH_JOB_STOPPED,
+            [DONE] = CUSH_JOB_DONE,
+        };
+        // Fill in only the fields the plugin knows of
+        struct cush_job current = {
+            .size = info->size, .jid = jid, .state = states[job->status],
+            .pgid = job->pgid, .nprocs = job->pipe->ncommands,
+            .nalive = job->num_processes_alive, .exit_status = job->exit_status,
+        };
+        memcpy(info, &current, info->size < sizeof current ? info->size : sizeof current);
+    }
+    if (!blocked)
+        signal_unblock(SIGCHLD);
+    return job ? 0 : -1;
+}
+
+/* enable [-n] name... enables builtins, or disables them so that the
+ * name runs the program of that name; enable alone lists them.
+ * enable -f plugin [name...] loads builtins from a plugin. */
+static int
+builtin_enable(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "-f") == 0)
+    {
+        if (argc == 2)
+            printf("usage: enable -f plugin [name...]\n");
+        if (argc == 2 || !plugins_load(argv[2], argv + 3, argc - 3))
+            var_set_status(1);
+        return BUILTIN_DONE;
+    }
+
+    bool enabled = !(argc > 1 && strcmp(argv[1], "-n") == 0);
+    int first = enabled ? 1 : 2;
+    if (argc == first)
+        builtin_print(stdout);
+    for (int i = first; i < argc; i++)
+    {
+        if (!builtin_set_enabled(argv[i], enabled))
+        {
+            fprintf(stderr, "cush: enable: %s: not a shell builtin\n", argv[i]);
+            var_set_status(1);
+        }
+    }
+    return BUILTIN_DONE;
+}
+
+/* Number of shell functions being run */
+static int function_depth;
+
+/* Return from a function, with status 'n' if given, else with the
+ * status of the last command; see run_builtin */
+static int
+builtin_return(int argc, char **argv)
+{
+    if (function_depth == 0)
+    {
+        fprintf(stderr, "cush: return: can only `return' from a function\n");
+        var_set_status(1);
+        return BUILTIN_DONE;
+    }
+    if (argc > 1)
+        var_set_status(atoi(argv[1]) & 0xff);
+    return BUILTIN_RETURN;
+}
+
+/* The events of a wait: each process waited for is a pidfd, whose
+ * event carries the fd and the pid.  A pidfd only reports that its
+ * process exited, so a signalfd for SIGCHLD reports stops, and stands
+ * in for the pidfds on kernels that do not have them. */
+#define WAIT_SIGNALFD UINT64_MAX
+#define WAIT_EVENT(fd, pid) ((uint64_t) (fd) << 32 | (uint32_t) (pid))
+
+/* Add the processes of 'job' that have not been reaped to 'epfd', and
+ * their pidfds to 'fds' */
+static void
+watch_job(int epfd, struct job *job, int *fds, int *nfds)
+{
+    for (int i = 0; i < job->pipe->ncommands && job->status != DONE; i++)
+    {
+        pid_t pid = job->pids[i];
+        if (pid <= 0)
+            continue;
+
+        int fd = syscall(SYS_pidfd_open, pid, 0);
+        if (fd == -1 && errno == ENOSYS)
+            return;     /* the signalfd reports its exit */
+        if (fd == -1)
+            continue;   /* reaped, and its pid not reused */
+
+        /* The pid of a process that was reaped may now be another's,
+         * which is not our child */
+        siginfo_t info;
+        if (waitid(P_PIDFD, fd, &info, WEXITED | WNOHANG | WNOWAIT) == -1)
+        {
+            close(fd);
+            continue;
+        }
+        struct epoll_event ev = {.events = EPOLLIN, .data.u64 = WAIT_EVENT(fd, pid)};
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+        fds[(*nfds)++] = fd;
+    }
+}
+
+/* Reap the child that 'ev' reports, or every child that changed state
+ * if it is the signalfd's */
+static void
+reap_waited(int epfd, struct epoll_event *ev, int sigfd)
+{
+    int status;
+    pid_t pid;
+    if (ev->data.u64 == WAIT_SIGNALFD)
+    {
+        struct signalfd_siginfo si;
+        while (read(sigfd, &si, sizeof si) > 0)
+            continue;
+        while ((pid = waitpid(-1, &status, WUNTRACED | WNOHANG)) > 0)
+            handle_child_status(pid, status);
+        return;
+    }
+
+    /* A pidfd stays readable once its process has exited, so it is
+     * taken out of the epoll after it has reported that */
+    epoll_ctl(epfd, EPOLL_CTL_DEL, ev->data.u64 >> 32, NULL);
+    pid = (uint32_t) ev->data.u64;
+    if (waitpid(pid, &status, WNOHANG) == pid)
+        handle_child_status(pid, status);
+}
+
+/* wait [spec...] waits until the given jobs, or all background jobs,
+ * are done; wait -n [spec...] until any one of them is.  The jobs are
+ * named by job specs, as for kill.  The shell
+ * sleeps in epoll_wait on a pidfd per process, so it wakes up once per
+ * process that exits instead of polling waitpid.  If one of the jobs
+ * is stopped, wait returns at once with status 128 plus the signal
+ * that stopped it, as the job cannot be done before it is continued. */
+static int
+builtin_wait(int argc, char **argv)
+{
+    bool any = argc > 1 && strcmp(argv[1], "-n") == 0;
+    int first = any ? 2 : 1;
+
+    signal_block(SIGCHLD);
+    int njobs = 0, nprocs = 0;
+    struct job **jobs = malloc((argc + list_size(&job_list)) * sizeof *jobs);
+    if (argc > first)
+    {
+        for (int i = first; i < argc; i++)
+            if (!add_job_spec("wait", argv[i], jobs, &njobs, true))
+                var_set_status(127);
+    }
+    else
+    {
+        for (struct list_elem *e = list_begin(&job_list);
+             e != list_end(&job_list); e = list_next(e))
+        {
+            struct job *job = list_entry(e, struct job, elem);
+            if (job->status == BACKGROUND || job->status == DONE)
+                jobs[njobs++] = job;
+        }
+    }
+    if (any && njobs == 0)
+        var_set_status(127);
+
+    for (int i = 0; i < njobs; i++)
+        nprocs += jobs[i]->pipe->ncommands;
+    int *fds = malloc(nprocs * sizeof *fds);
+    int nfds = 0;
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    int sigfd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    struct epoll_event sigev = {.events = EPOLLIN, .data.u64 = WAIT_SIGNALFD};
+    epoll_ctl(epfd, EPOLL_CTL_ADD, sigfd, &sigev);
+    for (int i = 0; i < njobs; i++)
+        watch_job(epfd, jobs[i], fds, &nfds);
+
+    struct job *done = NULL, *stopped = NULL;
+    for (;;)
+    {
+        int ndone = 0;
+        for (int i = 0; i < njobs; i++)
+        {
+            if (jobs[i]->status == STOPPED || jobs[i]->status == NEEDSTERMINAL)
+                stopped = jobs[i];
+            if (jobs[i]->status == DONE)
+            {
+                ndone++;
+                if (done == NULL || !any)
+                    done = jobs[i];
+            }
+        }
+        if (stopped)
+        {
+            var_set_status(128 + stopped->stop_signal);
+            done = NULL;
+            break;
+        }
+        if (ndone == njobs || (any && done))
+            break;
+
+        struct epoll_event events[16];
+        int n = epoll_wait(epfd, events, 16, -1);
+        if (n == -1 && errno == EINTR && interrupted)
+        {
+            var_set_status(130);
+            done = NULL;
+            break;
+        }
+        for (int i = 0; i < n; i++)
+            reap_waited(epfd, &events[i], sigfd);
+    }
+
+    /* wait without arguments only waits; otherwise its status is that
+     * of the job that completed, or of the last one given.  A job that was waited for is
+     * forgotten, as it is once jobs has reported it done. */
+    if (done && (any || argc > first))
+        var_set_status(done->exit_status);
+    for (int i = 0; i < njobs; i++)
+    {
+        if (jobs[i]->status == DONE && (!any || jobs[i] == done))
+            remove_from_list(jobs[i]);
+    }
+
+    for (int i = 0; i < nfds; i++)
+        close(fds[i]);
+    close(sigfd);
+    close(epfd);
+    free(fds);
+    free(jobs);
+    signal_unblock(SIGCHLD);
+    return BUILTIN_DONE;
+}
+
+/* The builtins that change the state of the shell (cd, exit, job
+ * control, variables and aliases) only make sense in the shell itself;
+ * the others may also run as a stage of a pipeline. */
+static const struct builtin builtins[] = {
+    {"kill", builtin_kill, BUILTIN_PIPELINE},
+    {"fg", builtin_fg, 0},
+    {"bg", builtin_bg, 0},
+    {"jobs", builtin_jobs, BUILTIN_PIPELINE},
+    {"stop", builtin_stop, 0},
+    {"exit", builtin_exit, 0},
+    {"cd", builtin_cd, 0},
+    {"parallel", builtin_parallel, BUILTIN_PIPELINE},
+    {"xargs", builtin_xargs, BUILTIN_PIPELINE},
+    {"coproc", builtin_coproc, 0},
+    {"astcache", builtin_astcache, BUILTIN_PIPELINE},
+    {"export", builtin_export, 0},
+    {"unset", builtin_unset, 0},
+    {"history", builtin_history, BUILTIN_PIPELINE},
+    {"alias", builtin_alias, 0},
+    {"unalias", builtin_unalias, 0},
+    {"hash", builtin_hash, 0},
+    {"type", builtin_type, BUILTIN_PIPELINE},
+    {"return", builtin_return, 0},
+    {"wait", builtin_wait, 0},
+    {"enable", builtin_enable, 0},
+};
+
+/* Run a builtin.  Returns one of the BUILTIN_ values. */
+static int
+run_builtin(builtin_func *builtin, char **argv)
+{
+    int argc = 0;
+    while (argv[argc] != NULL)
+        argc++;
+
+    // Builtins succeed unless they say otherwise.
+    int last_status = var_status();
+    var_set_status(0);
+
+    int rc = builtin(argc, argv);
+    if (rc == BUILTIN_RETURN && argc == 1)
+        var_set_status(last_status);
+    return rc;
+}
+
+static int isnum(char *cmd)
+{
+    for (int i = 0; i < strlen(cmd); i++)
+    {
+        if (!isdigit(cmd[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* The history is recalled with the arrow keys from hist.c rather than
+ * from readline's own list, which would have to be filled line by line
+ * with the whole history file at startup.  'recall_pos' is the entry
+ * being shown, or 0 while the line being typed is; that line is saved
+ * in 'typed_line' while an entry is shown. */
+static int recall_pos;
+static char *typed_line;
+
+/* Called by readline before it reads each line */
+static int
+recall_reset(void)
+{
+    recall_pos = 0;
+    free(typed_line);
+    typed_line = NULL;
+    return 0;
+}
+
+/* Move 'count' entries back in the history (forward if negative) */
+static int
+recall_move(int count)
+{
+    if (recall_pos == 0)
+    {
+        hist_sync();
+        typed_line = strdup(rl_line_buffer);
+        recall_pos = hist_last() + 1;
+    }
+
+    int pos = recall_pos - count;
+    if (pos < hist_first() || pos > hist_last() + 1)
+    {
+        rl_ding();
+        return 0;
+    }
+    recall_pos = pos;
+    rl_replace_line(pos > hist_last() ? typed_line : hist_get(pos), 0);
+    rl_point = rl_end;
+    return 0;
+}
+
+static int
+recall_previous(int count, int key)
+{
+    return recall_move(count);
+}
+
+static int
+recall_next(int count, int key)
+{
+    return recall_move(-count);
+}
+
+#define SEARCH_MAX 256
+
+/* Show entry 'n' with the cursor on the first occurrence of 'query' */
+static void
+search_show(int n, const char *query)
+{
+    const char *line = hist_get(n);
+    rl_replace_line(line, 0);
+    rl_point = strstr(line, query) - line;
+}
+
+/* ^R: incremental search backwards through the history with
+ * hist_search, in place of readline's own, which only knows its list.
+ * Typing extends the query, ^R looks for an older match, backspace
+ * shortens the query, ^G gives up and any other key accepts the match
+ * and is then processed as usual. */
+static int
+search_history(int count, int key)
+{
+    if (recall_pos == 0)
+    {
+        hist_sync();
+        typed_line = strdup(rl_line_buffer);
+    }
+
+    char query[SEARCH_MAX] = "";
+    size_t len = 0;
+    int match = 0;              /* the entry being shown, if any */
+    bool failed = false;
+    for (;;)
+    {
+        rl_message("(%sreverse-i-search)`%s': ", failed ? "failed " : "", query);
+        int c = rl_read_key();
+        int found;
+        if (c == CTRL('R'))
+        {
+            if (len == 0)
+                continue;
+            found = hist_search(query, match ? match : hist_last() + 1);
+        }
+        else if (c == 127 || c == CTRL('H'))
+        {
+            if (len == 0)
+                continue;
+            query[--len] = '\0';
+            found = hist_search(query, hist_last() + 1);
+        }
+        else if (c >= ' ' && c < 127 && len + 1 < SEARCH_MAX)
+        {
+            query[len++] = c;
+            query[len] = '\0';
+            /* The entry shown may still match the longer query */
+            found = hist_search(query, match ? match + 1 : hist_last() + 1);
+        }
+        else
+        {
+            if (c == CTRL('G'))
+            {
+                rl_replace_line(recall_pos ? hist_get(recall_pos) : typed_line, 0);
+                rl_point = rl_end;
+            }
+            else
+            {
+                if (match)
+                    recall_pos = match;
+                if (c != '\e')
+                    rl_execute_next(c);
+            }
+            break;
+        }
+
+        failed = found == 0 && len > 0;
+        if (found)
+        {
+            match = found;
+            search_show(match, query);
+        }
+        else if (failed)
+            rl_ding();
+        else
+            match = 0;
+    }
+    rl_clear_message();
+    return 0;
+}
+
+/* Bind the keys that readline uses to move through its history */
+static void
+recall_init(void)
+{
+    rl_startup_hook = recall_reset;
+    rl_bind_keyseq("\\e[A", recall_previous);
+    rl_bind_keyseq("\\eOA", recall_previous);
+    rl_bind_key(CTRL('P'), recall_previous);
+    rl_bind_keyseq("\\e[B", recall_next);
+    rl_bind_keyseq("\\eOB", recall_next);
+    rl_bind_key(CTRL('N'), recall_next);
+    rl_bind_key(CTRL('R'), search_history);
+}
+
+/* Keep the history in $HISTFILE, or in ~/.cush_history if it is not set.
+ * An empty HISTFILE keeps it in memory only.  $HISTBYTES limits the
+ * memory it uses. */
+static void
+history_init(void)
+{
+    const char *histbytes = getenv("HISTBYTES");
+    if (histbytes && *histbytes && isnum((char *) histbytes))
+        hist_set_budget(strtoul(histbytes, NULL, 10));
+
+    const char *histfile = getenv("HISTFILE");
+    if (histfile && *histfile == '\0')
+        return;
+
+    char path[PATH_MAX];
+    if (histfile == NULL)
+    {
+        const char *home = getenv("HOME");
+        if (home == NULL)
+            return;
+        snprintf(path, sizeof path, "%s/.cush_history", home);
+        histfile = path;
+    }
+    hist_open(histfile);
+}
+
+/* Perform history expansion on 'hist_cmd', which is freed.
+ * !! stands for the last entry, !N for entry N and !prefix for the
+ * newest entry that starts with prefix.  Returns the line to run, which
+ * the caller must free, or NULL if the entry does not exist. */
+static char *run_hist(char *hist_cmd)
+{
+    if (hist_cmd[0] != '!')
+    {
+        return hist_cmd;
+    }
+
+    char *com = &hist_cmd[1];
+    int n;
+    hist_sync();
+    if (strcmp(com, "!") == 0)
+    {
+        n = hist_last();
+    }
+    else if (isnum(com))
+    {
+        n = atoi(com);
+    }
+    else
+    {
+        n = hist_find_prefix(com);
+    }
+
+    const char *line = hist_get(n);
+    if (line == NULL)
+    {
+        fprintf(stderr, "cush: %s: event not found\n", hist_cmd);
+        free(hist_cmd);
+        return NULL;
+    }
+    free(hist_cmd);
+    printf("%s\n", line);
+    return strdup(line);
+}
+
+/* Replace the alias at the start of 'argv' by its value, which is split
+ * into words at blanks.  The new argv is allocated from 'arena'. */
+static char **
+expand_alias(char **argv, const char *alias, struct expand_arena *arena)
+{
+    for (const char *p = alias; *p;)
+    {
+        size_t len = strcspn(p, " \t");
+        if (len > 0)
+        {
+            char *word = obstack_copy0(&arena->strings, p, len);
+            obstack_ptr_grow(&arena->vectors, word);
+        }
+        p += len + strspn(p + len, " \t");
+    }
+    for (char **w = argv + 1; *w; w++)
+        obstack_ptr_grow(&arena->vectors, *w);
+    obstack_ptr_grow(&arena->vectors, NULL);
+    return obstack_finish(&arena->vectors);
+}
+
+/* Expand the target of a redirection into 'arena'.  It must expand to
+ * a single word; returns NULL, after reporting it, if it does not. */
+static const char *
+expand_redirection(char *target, struct expand_arena *arena)
+{
+    char *words[] = {target, NULL};
+    char **expanded = expand_words(words, arena);
+    if (expanded[0] == NULL || expanded[1] != NULL)
+    {
+        fprintf(stderr, "cush: %s: ambiguous redirect\n", target);
+        var_set_status(1);
+        return NULL;
+    }
+    return expanded[0];
+}
+
+/* Expand the words of every command of 'pipe' into 'arena', storing
+ * the argv of command i in ex->argvs[i], and replace aliases that are
+ * not hidden by a function; expand its redirection targets likewise.
+ * The pipeline is not modified.  Returns false if a command expanded
+ * to no words at all, or a redirection target to more or fewer than
+ * one. */
+static bool
+expand_pipeline(struct ast_pipeline *pipe, struct expanded_pipeline *ex, struct expand_arena *arena)
+{
+    char ***argvs = ex->argvs;
+    bool ok = true;
+    for (int i = 0; i < pipe->ncommands; i++)
+    {
+        argvs[i] = expand_words(pipe->commands[i].argv, arena);
+        if (argvs[i][0] == NULL)
+        {
+            ok = false;
+            continue;
+        }
+
+        struct command *cmd = command_lookup(argvs[i][0]);
+        if (cmd && cmd->alias && !cmd->function)
+            argvs[i] = expand_alias(argvs[i], cmd->alias, arena);
+        if (argvs[i][0] == NULL)
+            ok = false;
+    }
+
+    ex->input = ex->output = NULL;
+    if (pipe->iored_input && (ex->input = expand_redirection(pipe->iored_input, arena)) == NULL)
+        ok = false;
+    if (pipe->iored_output && (ex->output = expand_redirection(pipe->iored_output, arena)) == NULL)
+        ok = false;
+    return ok;
+}
+
+/* Deepest nesting of function calls */
+#define FUNCTION_DEPTH_MAX 1000
+
+/* Run function 'fn' with arguments argv[1]... as its positional
+ * parameters.  Returns BUILTIN_EXIT if the function exited the shell. */
+static int
+call_function(struct shell_function *fn, char **argv, int outfd)
+{
+    if (function_depth == FUNCTION_DEPTH_MAX)
+    {
+        fprintf(stderr, "cush: %s: maximum function nesting level exceeded\n", argv[0]);
+        var_set_status(1);
+        return BUILTIN_DONE;
+    }
+
+    int saved_argc;
+    char **saved_argv;
+    var_get_positional(&saved_argc, &saved_argv);
+
+    /* $0 remains that of the shell */
+    int argc = 0;
+    while (argv[argc])
+        argc++;
+    char *args[argc + 1];
+    memcpy(args, argv, (argc + 1) * sizeof *args);
+    args[0] = saved_argv[0];
+    var_set_positional(argc, args);
+
+    /* The function may be redefined while it runs */
+    struct ast_command_line *cline = ast_command_line_ref(fn->cmdline);
+    function_depth++;
+    int rc = run_code(cline, fn->start, fn->end, outfd);
+    function_depth--;
+    ast_command_line_unref(cline);
+
+    var_set_positional(saved_argc, saved_argv);
+    return rc == BUILTIN_EXIT ? BUILTIN_EXIT : BUILTIN_DONE;
+}
+
+/* An assignment sets a variable in whichever process runs it */
+static const struct builtin assignment = {"assignment", builtin_assign, BUILTIN_PIPELINE};
+
+/* Tell whether 'argv' runs inside the shell, and as what */
+static bool
+find_shell_command(char **argv, struct shell_command *sc)
+{
+    sc->function = NULL;
+    sc->builtin = NULL;
+    if (var_assignment(argv[0]))
+    {
+        sc->builtin = &assignment;
+        return true;
+    }
+
+    struct command *cmd = command_lookup(argv[0]);
+    if (cmd && cmd->function)
+        sc->function = cmd->function;
+    else
+        sc->builtin = builtin_lookup(argv[0]);
+    return sc->function || sc->builtin;
+}
+
+/* Run 'sc' in this process.  Returns one of the BUILTIN_ values. */
+static int
+run_shell_command(struct shell_command *sc, char **argv, int outfd)
+{
+    return sc->function ? call_function(sc->function, argv, outfd) : run_builtin(sc->builtin->func, argv);
+}
+
+/* Make 'fd' the shell's descriptor 'target' until restore_fds, keeping
+ * the one it replaces in 'saved' */
+static void
+replace_fd(int fd, int target, int saved[3])
+{
+    saved[target] = fcntl(target, F_DUPFD_CLOEXEC, 10);
+    dup2(fd, target);
+}
+
+static void
+restore_fds(int saved[3])
+{
+    fflush(stdout);
+    fflush(stderr);
+    for (int fd = 0; fd < 3; fd++)
+    {
+        if (saved[fd] != -1)
+        {
+            dup2(saved[fd], fd);
+            close(saved[fd]);
+        }
+    }
+}
+
+/* Apply the redirections of 'pipe', whose only command runs inside the
+ * shell, to the shell itself, opening the targets expanded in 'ex';
+ * output that is not redirected goes to 'outfd' if it is not -1.
+ * Returns false if a file cannot be opened. */
+static bool
+redirect_shell(struct ast_pipeline *pipe, const struct expanded_pipeline *ex, int outfd, int saved[3])
+{
+    fflush(stdout);
+    saved[0] = saved[1] = saved[2] = -1;
+    if (ex->input)
+    {
+        int fd = open_redirection(ex->input, O_RDONLY);
+        if (fd == -1)
+            return false;
+        replace_fd(fd, STDIN_FILENO, saved);
+        close(fd);
+    }
+    if (ex->output)
+    {
+        int fd = open_redirection(ex->output, output_flags(pipe));
+        if (fd == -1)
+            return false;
+        replace_fd(fd, STDOUT_FILENO, saved);
+        close(fd);
+    }
+    else if (outfd != -1)
+    {
+        replace_fd(outfd, STDOUT_FILENO, saved);
+    }
+    if (pipe->commands[0].dup_stderr_to_stdout)
+        replace_fd(STDOUT_FILENO, STDERR_FILENO, saved);
+    return true;
+}
+
+/* If the only command of 'pipe', as expanded in 'ex', is a function or
+ * builtin, run it inside the shell, without a fork, with the pipeline's
+ * redirections applied to the shell's own descriptors while it runs.
+ * Returns 0 if it is neither, else one of the BUILTIN_ values. */
+static int
+run_in_shell(struct ast_pipeline *pipe, const struct expanded_pipeline *ex, int outfd)
+{
+    char **argv = ex->argvs[0];
+    struct shell_command sc;
+    if (!find_shell_command(argv, &sc))
+        return 0;
+
+    int saved[3];
+    int rc = BUILTIN_DONE;
+    if (redirect_shell(pipe, ex, outfd, saved))
+        rc = run_shell_command(&sc, argv, ex->output ? -1 : outfd);
+    else
+        var_set_status(1);
+    restore_fds(saved);
+    return rc;
+}
+
+/* Expand and run one pipeline, or the function or builtin it consists
+ * of, which runs inside the shell unless it is put in the background.
+ * The expanded words are allocated from 'arena', which is reset
+ * after the pipeline has been started.
+ * Returns BUILTIN_EXIT or BUILTIN_RETURN if the pipeline exited the
+ * shell or returned from a function, else 0.
+ */
+static int
+run_pipeline(struct ast_pipeline *pipe, struct expand_arena *arena, int outfd)
+{
+    char **argvs[pipe->ncommands];
+    struct expanded_pipeline ex = {argvs};
+
+    int rc = 0;
+    if (expand_pipeline(pipe, &ex, arena))
+    {
+        bool alone = pipe->ncommands == 1 && !pipe->bg_job;
+        if (!alone || !(rc = run_in_shell(pipe, &ex, outfd)))
+            execute(pipe, &ex, outfd);
+    }
+    expand_arena_reset(arena);
+    return rc == BUILTIN_EXIT || rc == BUILTIN_RETURN ? rc : 0;
+}
+
+/* A for loop that is being run */
+struct loop_frame
+{
+    struct ast_for *loop;
+    struct expand_arena arena; /* holds the expanded words */
+    char **words;              /* the words not yet assigned */
+};
+
+/* Run the code of a command line from instruction 'pc' up to 'end':
+ * an instruction RUN i runs pipeline i, and the jumps implement if,
+ * while, for, && and ||, which test the exit status $? of the last
+ * pipeline.  If 'outfd' is not -1, the output of the pipelines is sent
+ * there.
+ * Returns BUILTIN_EXIT if the user asked the shell to exit,
+ * BUILTIN_RETURN if a function returned, else 0.
+ */
+static int
+run_code(struct ast_command_line *cline, int pc, int end, int outfd)
+{
+    struct expand_arena arena;
+    expand_arena_init(&arena);
+    struct loop_frame loops[cline->loop_depth + 1];
+    int depth = 0;
+    int rc = 0;
+
+    while (pc < end && rc == 0)
+    {
+        struct ast_insn insn = cline->code[pc++];
+        switch (insn.op)
+        {
+        case AST_RUN:
+            rc = run_pipeline(&cline->pipes[insn.arg], &arena, outfd);
+            break;
+
+        case AST_JUMP:
+            /* Every loop jumps backwards once per iteration */
+            if (interrupted)
+                goto out;
+            pc = insn.arg;
+            break;
+
+        case AST_JUMP_IF_FAIL:
+            if (var_status() != 0)
+                pc = insn.arg;
+            break;
+
+        case AST_JUMP_IF_OK:
+            if (var_status() == 0)
+                pc = insn.arg;
+            break;
+
+        case AST_SET_STATUS:
+            var_set_status(insn.arg);
+            break;
+
+        case AST_FOR_INIT:
+        {
+            struct loop_frame *frame = &loops[depth++];
+            frame->loop = &cline->loops[insn.arg];
+            expand_arena_init(&frame->arena);
+            frame->words = expand_words(frame->loop->words, &frame->arena);
+            var_set_status(0);
+            break;
+        }
+
+        case AST_FOR_NEXT:
+        {
+            struct loop_frame *frame = &loops[depth - 1];
+            if (interrupted)
+                goto out;
+            if (*frame->words)
+            {
+                var_set(frame->loop->name, *frame->words++);
+            }
+            else
+            {
+                expand_arena_release(&frame->arena);
+                depth--;
+                pc = insn.arg;
+            }
+            break;
+        }
+
+        case AST_FUNCTION:
+        {
+            struct ast_function *fn = &cline->functions[insn.arg];
+            command_define_function(fn->name, cline, fn->start, fn->end);
+            var_set_status(0);
+            pc = fn->end;
+            break;
+        }
         }
     }
-    return hist_cmd;
+
+out:
+    while (depth > 0)
+        expand_arena_release(&loops[--depth].arena);
+    expand_arena_release(&arena);
+    return rc;
+}
+
+/* Run the code of a command line.
+ * Returns true if the user asked the shell to exit.
+ */
+static bool
+run_command_line(struct ast_command_line *cline, int outfd)
+{
+    return run_code(cline, 0, cline->ncode, outfd) == BUILTIN_EXIT;
+}
+
+/* Run the command line of a command substitution, with its output
+ * sent to 'fd'.  An exit inside the substitution is ignored. */
+void
+run_command_substitution(char *cmd, int fd)
+{
+    struct ast_command_line *cline = ast_cache_parse(cmd);
+    if (cline == NULL)
+        return;
+
+    run_command_line(cline, fd);
+    ast_command_line_unref(cline);
+}
+
+/* Run a command line given to -c or read from a script.  These run
+ * without a terminal and without readline.  Returns the exit status
+ * of the shell, which is that of the last pipeline run. */
+static int
+run_noninteractive(struct ast_command_line *cline)
+{
+    if (cline == NULL) /* Error in command line */
+        return 2;
+
+    run_command_line(cline, -1);
+    ast_command_line_unref(cline);
+    return var_status();
+}
+
+/* Run the script in file 'path'.
+ * The file is mapped and parsed as a whole, in place. */
+static int
+run_script(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        fprintf(stderr, "cush: %s: %s\n", path, strerror(errno));
+        return 127;
+    }
+
+    size_t size;
+    char *script = utils_map_file(fd, &size);
+    close(fd);
+    if (script == NULL)
+    {
+        fprintf(stderr, "cush: %s: %s\n", path, strerror(errno));
+        return 126;
+    }
+
+    struct ast_command_line *cline = ast_parse_buffer(script, size);
+    utils_unmap_file(script, size);
+    return run_noninteractive(cline);
 }
 
 int main(int ac, char *av[])
 {
-    using_history();
     int opt;
+    char *command = NULL;
     signal(SIGINT, sigintHandler);
+    builtin_register(builtins, sizeof builtins / sizeof *builtins);
+    utilities_register(&interrupted);
+    plugins_init(plugin_next_job, plugin_get_job);
 
-    /* Process command-line arguments. See getopt(3) */
-    while ((opt = getopt(ac, av, "h")) > 0)
+    /* Process command-line arguments. See getopt(3)
+     * Options end at the script name; the rest are its arguments. */
+    while ((opt = getopt(ac, av, "+hc:p:")) > 0)
     // We would like to determine whether or not
     // the option is available to be used.
     {
@@ -987,12 +3349,44 @@ int main(int ac, char *av[])
         case 'h':
             usage(av[0]);
             break;
+        case 'c':
+            command = optarg;
+            break;
+        case 'p':
+            plugins_load_dir(optarg);
+            break;
+        default:
+            exit(2);
         }
     }
 
     list_init(&job_list);
     signal_set_handler(SIGCHLD, sigchld_handler);
-    termstate_init();
+
+    var_set_shell_pid(getpid());
+
+    /* $0 is the shell or the script, followed by its arguments.
+     * With -c, the arguments after the command start at $0. */
+    if (optind < ac)
+        var_set_positional(ac - optind, av + optind);
+    else
+        var_set_positional(1, av);
+
+    if (command)
+        return run_noninteractive(ast_parse_command_line(command));
+    if (optind < ac)
+        return run_script(av[optind]);
+
+    /* Only take charge of the terminal if the shell reads from it.
+     * There the user stops, resumes and kills a sleep as a job, which a
+     * builtin cannot be, so sleep is the program unless enabled. */
+    if (isatty(0))
+    {
+        termstate_init();
+        builtin_set_enabled("sleep", false);
+    }
+    history_init();
+    recall_init();
 
     int num_com = 0;
 
@@ -1009,77 +3403,55 @@ int main(int ac, char *av[])
 
         if (cmdline == NULL) /* User typed EOF */
             break;
+        interrupted = 0;
 
         int recent = 0;
-        int hist = 0;
         if (strcmp(cmdline, "!!") == 0)
         {
             recent = 1;
         }
-        if (strncmp(cmdline, "!", 1) == 0)
-        {
-            hist = 1;
-        }
         if ((cmdline = run_hist(cmdline)) == NULL)
         {
             continue;
         }
-        struct ast_command_line *cline = ast_parse_command_line(cmdline); // We would like to parse
+        struct ast_command_line *cline = ast_cache_parse(cmdline); // We would like to parse
                                                                           // each job, where
                                                                           // job contains multiple
                                                                           // pipelines.
         if (!recent)
         {
             // only add to history if not calling most recent command
-            add_history(cmdline);
-        }
-        if (!hist)
-        {
-            // free if not calling previous command
-            free(cmdline);
+            hist_add(cmdline);
         }
+        free(cmdline);
         if (cline == NULL) /* Error in command line */
+        {
             // If something goes wrong with pipeline, what are we supposed
             // to do
+            var_set_status(2);
             continue;
+        }
 
-        if (list_empty(&cline->pipes))
+        if (cline->ncode == 0)
         { /* User hit enter */
             // If the command line does not contain pipelines, we
             // will be ready to free it.
-            ast_command_line_free(cline);
+            ast_command_line_unref(cline);
             continue;
         }
         // ast_command_line_print(cline); /* Output a representation of
         /* the entered command line */
-        // We may focus on each pipeline
-        for (struct list_elem *e = list_begin(&cline->pipes);
-             e != list_end(&cline->pipes);
-             e = list_next(e))
+        if (run_command_line(cline, -1))
         {
-            // We deal with pipe one-by-one.
-            struct ast_pipeline *pipe = list_entry(e, struct ast_pipeline, elem);
-            int end = 0;
-            if (!(end = runBuiltIn(pipe)))
-            {
-                execute(pipe);
-            }
-            if (end == 2)
-            {
-                ast_command_line_free(cline);
-                exit(0);
-            }
+            ast_command_line_unref(cline);
+            exit(var_status());
         }
-        /* Free the command line.
-         * This will free the ast_pipeline objects still contained
-         * in the ast_command_line.  Once you implement a job list
-         * that may take ownership of ast_pipeline objects that are
-         * associated with jobs you will need to reconsider how you
-         * manage the lifetime of the associated ast_pipelines.
-         * Otherwise, freeing here will cause use-after-free errors.
+        /* Drop our reference to the command line.
+         * Jobs that are still running one of its pipelines hold their
+         * own reference, so the command line is freed once the last
+         * of them has been deleted.
          */
-        // ast_command_line_free(cline);
-        free(cline);
+        ast_command_line_unref(cline);
     }
     return 0;
 }
\ No newline at end of file
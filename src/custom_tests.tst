@@ -1,2 +1,6 @@
 = Tests for Custom Features
 1 gback_glob_test.py
+1 parallel_test.py
+1 control_flow_test.py
+1 utilities_test.py
+1 job_control_test.py
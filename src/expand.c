@@ -0,0 +1,487 @@
+/*
+ * Expansion of words before a command is run.
+ *
+ * The scanner leaves words that contain a $ as they were typed.
+ * expand_words() performs parameter expansion, command substitution and
+ * quote removal on them in a single pass over each word: the fields of
+ * a word are built directly in the arena, without an intermediate
+ * string for each expansion.  Words that contain unquoted wildcards are
+ * then replaced by the pathnames they match (see globbing.c).  Words
+ * without a $ or a wildcard are used as they are.
+ *
+ * Characters that stand for themselves in a pattern, such as a quoted *,
+ * are escaped with a backslash while a field is built.  The escapes are
+ * removed again if the field does not turn out to be a pattern.
+ *
+ * The output of a command substitution is written by the command
+ * directly into a memfd, which is then mapped.  Words are split in
+ * place by terminating them inside the mapping, so the output is not
+ * copied unless a word consists of more than the substitution alone.
+ */
+#define _GNU_SOURCE 1
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "expand.h"
+#include "globbing.h"
+#include "variables.h"
+
+#define obstack_chunk_alloc malloc
+#define obstack_chunk_free free
+
+/* Words that contain none of these are used as they are */
+#define EXPAND_CHARS "$*?["
+
+/* The mapped output of one command substitution */
+struct capture {
+    char *map;
+    size_t size;
+    struct capture *next;
+};
+
+/* State while the fields of one word are being produced.
+ * The current field is either empty, 'borrowed' (a string that lives
+ * elsewhere and is used as is), or being grown in the strings obstack.
+ */
+struct field_builder {
+    struct expand_arena *arena;
+    char *borrowed;     /* current field, if it is borrowed */
+    bool growing;       /* current field is being grown in the obstack */
+    bool quoted;        /* current field exists even if empty ("") */
+    bool glob;          /* current field has an unquoted *, ? or [ */
+    bool escaped;       /* current field has escapes to remove */
+};
+
+void
+expand_arena_init(struct expand_arena *arena)
+{
+    obstack_init(&arena->strings);
+    obstack_init(&arena->vectors);
+    arena->captures = NULL;
+    arena->strings_base = obstack_alloc(&arena->strings, 0);
+    arena->vectors_base = obstack_alloc(&arena->vectors, 0);
+}
+
+static void
+release_captures(struct expand_arena *arena)
+{
+    while (arena->captures) {
+        struct capture *c = arena->captures;
+        arena->captures = c->next;
+        munmap(c->map, c->size + 1);
+        free(c);
+    }
+}
+
+void
+expand_arena_release(struct expand_arena *arena)
+{
+    obstack_free(&arena->strings, NULL);
+    obstack_free(&arena->vectors, NULL);
+    release_captures(arena);
+}
+
+void
+expand_arena_reset(struct expand_arena *arena)
+{
+    /* Freeing back to the first object keeps the first chunk */
+    obstack_free(&arena->strings, arena->strings_base);
+    obstack_free(&arena->vectors, arena->vectors_base);
+    arena->strings_base = obstack_alloc(&arena->strings, 0);
+    arena->vectors_base = obstack_alloc(&arena->vectors, 0);
+    release_captures(arena);
+}
+
+static bool
+is_pattern_char(char c)
+{
+    return c == '*' || c == '?' || c == '[' || c == '\\';
+}
+
+/* Append 'len' bytes to the current field, copying it if it was borrowed.
+ * Unless 'quoted', the wildcards in it are active. */
+static void
+field_append(struct field_builder *fb, const char *text, size_t len, bool quoted)
+{
+    struct obstack *strings = &fb->arena->strings;
+    if (fb->borrowed) {
+        obstack_grow(strings, fb->borrowed, strlen(fb->borrowed));
+        fb->borrowed = NULL;
+    }
+
+    const char *run = text, *end = text + len;
+    for (const char *p = text; p < end; p++) {
+        if (!is_pattern_char(*p))
+            continue;
+        if (!quoted && *p != '\\') {
+            fb->glob = true;
+            continue;
+        }
+        obstack_grow(strings, run, p - run);
+        obstack_1grow(strings, '\\');
+        run = p;
+        fb->escaped = true;
+    }
+    obstack_grow(strings, run, end - run);
+    fb->growing = true;
+}
+
+/* Append a string that remains valid as long as the arena to the
+ * current field.  If the field is empty and the string has no pattern
+ * characters, it is used without copying. */
+static void
+field_append_borrowed(struct field_builder *fb, char *text, bool quoted)
+{
+    if (fb->borrowed || fb->growing || text[strcspn(text, "*?[\\")] != '\0')
+        field_append(fb, text, strlen(text), quoted);
+    else
+        fb->borrowed = text;
+}
+
+/* Remove the backslash escapes from 'field', in place */
+static void
+remove_escapes(char *field)
+{
+    char *out = field;
+    for (char *p = field; *p; p++) {
+        if (*p == '\\' && p[1])
+            p++;
+        *out++ = *p;
+    }
+    *out = '\0';
+}
+
+/* Finish the current field and add it to the argv being built. */
+static void
+field_end(struct field_builder *fb)
+{
+    char *field = NULL;
+    if (fb->borrowed) {
+        field = fb->borrowed;
+    } else if (fb->growing) {
+        obstack_1grow(&fb->arena->strings, '\0');
+        field = obstack_finish(&fb->arena->strings);
+        /* A pattern is replaced by its matches, if there are any */
+        if (fb->glob && glob_expand(field, &fb->arena->strings, &fb->arena->vectors) > 0)
+            field = NULL;
+        else if (fb->escaped)
+            remove_escapes(field);
+    } else if (fb->quoted) {
+        field = "";
+    }
+
+    if (field)
+        obstack_ptr_grow(&fb->arena->vectors, field);
+
+    fb->borrowed = NULL;
+    fb->growing = fb->quoted = fb->glob = fb->escaped = false;
+}
+
+/* Return a file descriptor for an anonymous file to capture output in */
+static int
+capture_fd(void)
+{
+    int fd = memfd_create("cush-subst", MFD_CLOEXEC);
+    if (fd == -1)
+        fd = open(P_tmpdir, O_TMPFILE | O_RDWR | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    return fd;
+}
+
+/* Run command 'cmd' and return its output, mapped and NUL-terminated,
+ * or NULL if there was none. */
+static char *
+capture_output(char *cmd, struct expand_arena *arena)
+{
+    int fd = capture_fd();
+    if (fd == -1) {
+        perror("cush: cannot capture command output");
+        return NULL;
+    }
+
+    run_command_substitution(cmd, fd);
+
+    struct stat st;
+    char *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0 && ftruncate(fd, st.st_size + 1) == 0)
+        map = mmap(NULL, st.st_size + 1, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+        return NULL;
+
+    struct capture *c = malloc(sizeof *c);
+    c->map = map;
+    c->size = st.st_size;
+    c->next = arena->captures;
+    arena->captures = c;
+    return map;
+}
+
+static bool
+is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+/* Substitute the output of 'cmd' into the current word.
+ * Unless 'quoted', the output is split into fields at blanks. */
+static void
+substitute(struct field_builder *fb, char *cmd, bool quoted)
+{
+    char *out = capture_output(cmd, fb->arena);
+    if (out == NULL)
+        return;
+
+    size_t len = strlen(out);
+    while (len > 0 && out[len - 1] == '\n')
+        out[--len] = '\0';
+
+    if (quoted) {
+        field_append_borrowed(fb, out, true);
+        return;
+    }
+
+    char *p = out;
+    for (;;) {
+        if (is_blank(*p)) {
+            field_end(fb);
+            while (is_blank(*p))
+                p++;
+        }
+        if (*p == '\0')
+            break;
+
+        char *start = p;
+        while (*p && !is_blank(*p))
+            p++;
+
+        /* A field followed by a blank is complete; the last one may
+         * still be continued by the rest of the word. */
+        bool complete = *p != '\0';
+        if (complete)
+            *p++ = '\0';
+        field_append_borrowed(fb, start, false);
+        if (complete)
+            field_end(fb);
+    }
+}
+
+/* Return the ) that closes the ( at 'open', or NULL */
+static char *
+matching_paren(char *open)
+{
+    int depth = 0;
+    for (char *p = open; *p; p++) {
+        if (*p == '(')
+            depth++;
+        else if (*p == ')' && --depth == 0)
+            return p;
+    }
+    return NULL;
+}
+
+/* Add 'value', the value of a parameter, to the current field.
+ * Unless 'quoted', it is split into fields at blanks. */
+static void
+append_value(struct field_builder *fb, const char *value, bool quoted)
+{
+    if (quoted) {
+        field_append(fb, value, strlen(value), true);
+        return;
+    }
+
+    while (*value) {
+        if (is_blank(*value)) {
+            field_end(fb);
+            while (is_blank(*value))
+                value++;
+        } else {
+            size_t n = strcspn(value, " \t\n");
+            field_append(fb, value, n, false);
+            value += n;
+        }
+    }
+}
+
+/* Return the length of the parameter name at 'p': a variable name,
+ * a positional parameter, or one of the special parameters ? and $.
+ * $# is left alone, as commands such as sh -c "echo $#" rely on it. */
+static size_t
+parameter_name_length(const char *p)
+{
+    if (*p == '?' || *p == '$' || isdigit((unsigned char) *p))
+        return 1;
+
+    size_t n = 0;
+    while (isalnum((unsigned char) p[n]) || p[n] == '_')
+        n++;
+    return var_valid_name(p, n) ? n : 0;
+}
+
+/* Return the value of the parameter whose name is the 'len' bytes at
+ * 'name', or NULL if it is not set.  Numbers are formatted into 'buf'. */
+static const char *
+parameter_value(const char *name, size_t len, char buf[static 16])
+{
+    switch (*name) {
+    case '?':
+        snprintf(buf, 16, "%d", var_status());
+        return buf;
+    case '$':
+        snprintf(buf, 16, "%d", (int) var_shell_pid());
+        return buf;
+    }
+    if (isdigit((unsigned char) *name))
+        return var_positional(*name - '0');
+    return var_lookup(name, len);
+}
+
+/* Return the } that ends the ${ at 'p', or NULL */
+static char *
+closing_brace(char *p)
+{
+    int depth = 0;
+    char quote = 0;
+    for (; *p; p++) {
+        if (quote) {
+            if (*p == quote)
+                quote = 0;
+            else if (*p == '\\' && quote == '"' && p[1])
+                p++;
+        } else if (*p == '"' || *p == '\'') {
+            quote = *p;
+        } else if (*p == '\\' && p[1]) {
+            p++;
+        } else if (*p == '{') {
+            depth++;
+        } else if (*p == '}' && --depth == 0) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static char *expand_text(struct field_builder *fb, char *p, char end, bool in_quotes);
+
+/* Expand the $ expression at 'p' into the current field.
+ * Returns the position after it. */
+static char *
+expand_dollar(struct field_builder *fb, char *p, bool quoted)
+{
+    char buf[16];
+
+    if (p[1] == '(' && matching_paren(p + 1)) {
+        char *close = matching_paren(p + 1);
+        char *cmd = strndup(p + 2, close - (p + 2));
+        substitute(fb, cmd, quoted);
+        free(cmd);
+        return close + 1;
+    }
+
+    if (p[1] == '{') {
+        char *name = p + 2;
+        size_t len = parameter_name_length(name);
+        char *op = name + len;
+        char *close = closing_brace(p + 1);
+        if (len == 0 || close == NULL || !(*op == '}' || *op == '-' || (op[0] == ':' && op[1] == '-')))
+            goto literal;
+
+        const char *value = parameter_value(name, len, buf);
+        bool use_default = *op != '}' && (value == NULL || (*op == ':' && *value == '\0'));
+        if (use_default)
+            expand_text(fb, op + (*op == ':' ? 2 : 1), '}', quoted);
+        else if (value)
+            append_value(fb, value, quoted);
+        return close + 1;
+    }
+
+    size_t len = parameter_name_length(p + 1);
+    if (len > 0) {
+        const char *value = parameter_value(p + 1, len, buf);
+        if (value)
+            append_value(fb, value, quoted);
+        return p + 1 + len;
+    }
+
+literal:
+    field_append(fb, p, 1, true);
+    return p + 1;
+}
+
+/* Expand the text at 'p' into the current field, up to the end of the
+ * string or the first 'end' character that is not quoted.  If 'in_quotes',
+ * the text is within double quotes.  Returns the position of the end. */
+static char *
+expand_text(struct field_builder *fb, char *p, char end, bool in_quotes)
+{
+    bool dq = false;
+
+    while (*p && (dq || *p != end)) {
+        bool quoted = in_quotes || dq;
+
+        if (*p == '"') {
+            dq = !dq;
+            fb->quoted = true;
+            p++;
+        } else if (*p == '\'' && !quoted && strchr(p + 1, '\'')) {
+            char *close = strchr(p + 1, '\'');
+            fb->quoted = true;
+            field_append(fb, p + 1, close - (p + 1), true);
+            p = close + 1;
+        } else if (*p == '\\' && (p[1] == '$' || p[1] == end
+                                  || (quoted && (p[1] == '"' || p[1] == '\\'))
+                                  || (!quoted && (p[1] == '*' || p[1] == '?' || p[1] == '[')))) {
+            field_append(fb, p + 1, 1, true);
+            p += 2;
+        } else if (*p == '$') {
+            p = expand_dollar(fb, p, quoted);
+        } else {
+            /* copy a run of ordinary characters at once */
+            size_t n = 1;
+            while (p[n] && !strchr("\"'\\$", p[n]) && (dq || p[n] != end))
+                n++;
+            field_append(fb, p, n, quoted);
+            p += n;
+        }
+    }
+    return p;
+}
+
+/* Expand one word, adding its fields to the argv being built.
+ * If 'assignment', the word is not split into fields. */
+static void
+expand_word(char *word, bool assignment, struct expand_arena *arena)
+{
+    struct field_builder fb = { .arena = arena };
+    expand_text(&fb, word, '\0', assignment);
+    field_end(&fb);
+}
+
+char **
+expand_words(char **argv, struct expand_arena *arena)
+{
+    char **w = argv;
+    while (*w && !strpbrk(*w, EXPAND_CHARS))
+        w++;
+    if (*w == NULL)
+        return argv;
+
+    /* Leading NAME=value words are assignments, whose values are not split */
+    bool assignments = true;
+    for (w = argv; *w; w++) {
+        assignments = assignments && var_assignment(*w);
+        if (strpbrk(*w, EXPAND_CHARS))
+            expand_word(*w, assignments, arena);
+        else
+            obstack_ptr_grow(&arena->vectors, *w);
+    }
+    obstack_ptr_grow(&arena->vectors, NULL);
+    return obstack_finish(&arena->vectors);
+}
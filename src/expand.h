@@ -0,0 +1,48 @@
+#ifndef __EXPAND_H
+#define __EXPAND_H
+
+#include <stddef.h>
+#include <obstack.h>
+
+struct capture;
+
+/* Memory for the words produced by expanding the commands of a pipeline.
+ * Everything allocated from an arena is released together by
+ * expand_arena_reset or expand_arena_release once the pipeline has been
+ * started.
+ */
+struct expand_arena {
+    struct obstack strings;   /* expanded words that had to be copied */
+    struct obstack vectors;   /* argv arrays of expanded commands */
+    struct capture *captures; /* output of command substitutions */
+    char *strings_base;       /* first object of each obstack */
+    char *vectors_base;
+};
+
+/* Initialize an expansion arena */
+void expand_arena_init(struct expand_arena *arena);
+
+/* Release all memory held by an expansion arena */
+void expand_arena_release(struct expand_arena *arena);
+
+/* Free everything allocated from an arena, but keep it ready for use,
+ * so that a loop does not set up a new arena for every pipeline */
+void expand_arena_reset(struct expand_arena *arena);
+
+/* Expand the NULL-terminated word list 'argv'.
+ * Performs parameter expansion ($NAME, ${NAME}, ${NAME:-word},
+ * ${NAME-word}, $?, $$, $0...$9), command substitution and quote
+ * removal on words that contain a $; the result of unquoted expansions
+ * is split into words, except in leading NAME=value assignments.
+ * Fields with unquoted wildcards are replaced by the pathnames they
+ * match, if any.
+ * Returns 'argv' itself if there is nothing to expand, else a new
+ * NULL-terminated array allocated from 'arena'.
+ */
+char **expand_words(char **argv, struct expand_arena *arena);
+
+/* Run the command line 'cmd' with its standard output written to
+ * file descriptor 'fd', and wait for it.  Implemented in cush.c */
+void run_command_substitution(char *cmd, int fd);
+
+#endif /* __EXPAND_H */
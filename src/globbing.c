@@ -0,0 +1,745 @@
+/*
+ * Pathname expansion.
+ *
+ * A pattern is matched one pathname component at a time.  Components
+ * without wildcards are appended as they are; for the others, the
+ * directory is listed and every entry is matched against the component
+ * in place, so matching does not allocate per entry.
+ *
+ * Directories are read with getdents64 into a large buffer, and their
+ * listings are kept in a small cache keyed by device and inode.  A
+ * listing is reused for a few seconds as long as the directory's mtime
+ * has not changed, so a script that globs the same large directory
+ * repeatedly reads it only once.  A listing taken within a second of
+ * the directory's last change is not cached, because a later change in
+ * the same clock tick would not be noticed.
+ *
+ * A component that is exactly ** matches any number of directories,
+ * including none.  The tree below it is walked by a pool of threads:
+ * each thread reads directories with openat and getdents64, matches
+ * their entries against the component that follows the **, and queues
+ * the subdirectories it finds on its own deque, from which idle threads
+ * steal.  Hidden directories and symbolic links are not descended into.
+ * The matches are sorted together afterwards, so the result does not
+ * depend on the order in which the threads found them.
+ */
+#define _GNU_SOURCE 1
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "globbing.h"
+#include "list.h"
+
+#define obstack_chunk_alloc malloc
+#define obstack_chunk_free free
+
+#define DIR_CACHE_SIZE 16       /* directory listings kept */
+#define DIR_CACHE_TTL 5         /* seconds a listing may be reused */
+#define DENTS_BUFSIZE (64 * 1024)
+#define WALK_MAX_THREADS 16
+
+struct dir_entry {
+    uint32_t name;              /* offset of the name in 'names' */
+    unsigned char type;         /* DT_* type, or DT_UNKNOWN */
+};
+
+/* The names in one directory, except . and .. */
+struct dir_listing {
+    struct list_elem elem;      /* position in the LRU list, if cached */
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;      /* mtime of the directory when it was read */
+    time_t loaded;              /* CLOCK_MONOTONIC seconds when it was read */
+    bool cached;
+    int refcount;
+    size_t nentries;
+    struct dir_entry *entries;
+    char *names;
+};
+
+static struct list dir_cache;   /* most recently used listing first */
+static bool dir_cache_initialized;
+static int dir_cache_entries;
+
+/* State of one expansion */
+struct glob_state {
+    char path[PATH_MAX];        /* pathname matched so far */
+    char **matches;
+    size_t nmatches, capacity;
+    struct obstack *strings;
+};
+
+static time_t
+monotonic_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static void
+dir_listing_unref(struct dir_listing *dir)
+{
+    if (--dir->refcount == 0) {
+        free(dir->entries);
+        free(dir->names);
+        free(dir);
+    }
+}
+
+static void
+dir_cache_remove(struct dir_listing *dir)
+{
+    list_remove(&dir->elem);
+    dir->cached = false;
+    dir_cache_entries--;
+    dir_listing_unref(dir);
+}
+
+/* Read the directory open as 'fd' with getdents64.
+ * Returns NULL if it cannot be read. */
+static struct dir_listing *
+read_directory(int fd, const struct stat *st)
+{
+    char *buf = malloc(DENTS_BUFSIZE);
+    size_t names_cap = st->st_size > 4096 ? st->st_size : 4096;
+    size_t entries_cap = names_cap / 16;
+    size_t names_len = 0, n = 0;
+    char *names = malloc(names_cap);
+    struct dir_entry *entries = malloc(entries_cap * sizeof *entries);
+
+    ssize_t len;
+    while ((len = getdents64(fd, buf, DENTS_BUFSIZE)) > 0) {
+        for (char *p = buf; p < buf + len; p += ((struct dirent64 *) p)->d_reclen) {
+            struct dirent64 *d = (struct dirent64 *) p;
+            if (d->d_name[0] == '.' && (d->d_name[1] == '\0'
+                                        || (d->d_name[1] == '.' && d->d_name[2] == '\0')))
+                continue;
+
+            size_t namelen = strlen(d->d_name) + 1;
+            if (names_len + namelen > names_cap)
+                names = realloc(names, names_cap = 2 * names_cap + namelen);
+            if (n == entries_cap)
+                entries = realloc(entries, (entries_cap *= 2) * sizeof *entries);
+
+            entries[n].name = names_len;
+            entries[n].type = d->d_type;
+            n++;
+            memcpy(names + names_len, d->d_name, namelen);
+            names_len += namelen;
+        }
+    }
+    free(buf);
+
+    if (len < 0) {
+        free(names);
+        free(entries);
+        return NULL;
+    }
+
+    struct dir_listing *dir = malloc(sizeof *dir);
+    dir->dev = st->st_dev;
+    dir->ino = st->st_ino;
+    dir->mtime = st->st_mtim;
+    dir->loaded = monotonic_seconds();
+    dir->cached = false;
+    dir->refcount = 1;
+    dir->nentries = n;
+    dir->entries = entries;
+    dir->names = names;
+    return dir;
+}
+
+/* Return the listing of directory 'path', from the cache if it is
+ * still valid.  The caller must drop it with dir_listing_unref. */
+static struct dir_listing *
+dir_listing_get(const char *path)
+{
+    if (!dir_cache_initialized) {
+        list_init(&dir_cache);
+        dir_cache_initialized = true;
+    }
+
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+        return NULL;
+
+    for (struct list_elem *e = list_begin(&dir_cache); e != list_end(&dir_cache); e = list_next(e)) {
+        struct dir_listing *dir = list_entry(e, struct dir_listing, elem);
+        if (dir->dev != st.st_dev || dir->ino != st.st_ino)
+            continue;
+
+        if (dir->mtime.tv_sec == st.st_mtim.tv_sec && dir->mtime.tv_nsec == st.st_mtim.tv_nsec
+            && monotonic_seconds() - dir->loaded < DIR_CACHE_TTL) {
+            list_remove(&dir->elem);
+            list_push_front(&dir_cache, &dir->elem);
+            dir->refcount++;
+            return dir;
+        }
+        dir_cache_remove(dir);
+        break;
+    }
+
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+
+    struct dir_listing *dir = NULL;
+    if (fstat(fd, &st) == 0)
+        dir = read_directory(fd, &st);
+    close(fd);
+    if (dir == NULL)
+        return NULL;
+
+    /* Don't cache a directory that was changed within the last second */
+    if (time(NULL) - st.st_mtim.tv_sec >= 1) {
+        if (dir_cache_entries == DIR_CACHE_SIZE)
+            dir_cache_remove(list_entry(list_back(&dir_cache), struct dir_listing, elem));
+        dir->cached = true;
+        dir->refcount++;
+        dir_cache_entries++;
+        list_push_front(&dir_cache, &dir->elem);
+    }
+    return dir;
+}
+
+void
+glob_cache_clear(void)
+{
+    if (!dir_cache_initialized)
+        return;
+
+    while (!list_empty(&dir_cache))
+        dir_cache_remove(list_entry(list_front(&dir_cache), struct dir_listing, elem));
+}
+
+/* Return the ] that closes the bracket expression at 'p', which
+ * follows a [, or NULL if there is none before 'end'. */
+static const char *
+bracket_end(const char *p, const char *end)
+{
+    if (p < end && (*p == '!' || *p == '^'))
+        p++;
+    if (p < end && *p == ']')
+        p++;
+    for (; p < end; p++) {
+        if (*p == '\\' && p + 1 < end)
+            p++;
+        else if (*p == ']')
+            return p;
+    }
+    return NULL;
+}
+
+/* Return true if 'c' is in the bracket expression from 'p' to the
+ * closing ] at 'close' */
+static bool
+bracket_match(const char *p, const char *close, unsigned char c)
+{
+    bool negate = *p == '!' || *p == '^';
+    if (negate)
+        p++;
+
+    bool found = false;
+    while (p < close) {
+        unsigned char lo = *p == '\\' && p + 1 < close ? *++p : *p;
+        p++;
+        unsigned char hi = lo;
+        if (p + 1 < close && *p == '-') {
+            hi = p[1] == '\\' && p + 2 < close ? p[2] : p[1];
+            p += p[1] == '\\' && p + 2 < close ? 3 : 2;
+        }
+        if (lo <= c && c <= hi)
+            found = true;
+    }
+    return found != negate;
+}
+
+/* Return true if 'name' matches the pattern from 'p' to 'end' */
+static bool
+pattern_match(const char *p, const char *end, const char *name)
+{
+    const char *star_p = NULL, *star_name = NULL;
+
+    while (*name) {
+        if (p < end && *p == '*') {
+            star_p = ++p;
+            star_name = name;
+            continue;
+        }
+
+        const char *next = NULL;
+        if (p < end) {
+            const char *close;
+            if (*p == '?') {
+                next = p + 1;
+            } else if (*p == '[' && (close = bracket_end(p + 1, end)) != NULL) {
+                if (bracket_match(p + 1, close, *name))
+                    next = close + 1;
+            } else if (*p == '\\' && p + 1 < end) {
+                if (p[1] == *name)
+                    next = p + 2;
+            } else if (*p == *name) {
+                next = p + 1;
+            }
+        }
+
+        if (next) {
+            p = next;
+            name++;
+        } else if (star_p) {
+            p = star_p;
+            name = ++star_name;
+        } else {
+            return false;
+        }
+    }
+
+    while (p < end && *p == '*')
+        p++;
+    return p == end;
+}
+
+/* Return true if the component from 'p' to 'end' has wildcards */
+static bool
+component_has_magic(const char *p, const char *end)
+{
+    for (; p < end; p++) {
+        if (*p == '\\' && p + 1 < end)
+            p++;
+        else if (*p == '*' || *p == '?' || (*p == '[' && bracket_end(p + 1, end)))
+            return true;
+    }
+    return false;
+}
+
+bool
+glob_has_magic(const char *pattern)
+{
+    return component_has_magic(pattern, pattern + strlen(pattern));
+}
+
+static void
+add_match(struct glob_state *g, size_t len)
+{
+    if (g->nmatches == g->capacity)
+        g->matches = realloc(g->matches, (g->capacity = 2 * g->capacity + 16) * sizeof *g->matches);
+    g->matches[g->nmatches++] = obstack_copy0(g->strings, g->path, len);
+}
+
+/* Append the component from 'p' to 'end' to the path at 'len',
+ * removing backslash escapes.  Returns the new length, or 0 if the
+ * path would be too long. */
+static size_t
+append_literal(struct glob_state *g, size_t len, const char *p, const char *end)
+{
+    for (; p < end; p++) {
+        if (*p == '\\' && p + 1 < end)
+            p++;
+        if (len >= PATH_MAX - 1)
+            return 0;
+        g->path[len++] = *p;
+    }
+    return len;
+}
+
+/* Return true if the entry whose path is in g->path is a directory */
+static bool
+entry_is_dir(struct glob_state *g, unsigned char type)
+{
+    if (type == DT_DIR)
+        return true;
+    if (type != DT_LNK && type != DT_UNKNOWN)
+        return false;
+
+    struct stat st;
+    return stat(g->path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/* A directory to be read by the ** walker */
+struct walk_item {
+    size_t len;
+    char path[];                /* relative to the walk's base, with a
+                                   trailing / unless it is the base */
+};
+
+/* The directories queued by one thread.  The owner takes the most
+ * recently queued one (depth first); thieves take the oldest. */
+struct walk_deque {
+    pthread_mutex_t lock;
+    struct walk_item **items;   /* items[head] up to items[tail] */
+    size_t head, tail, capacity;
+};
+
+/* The matches found by one thread */
+struct walk_results {
+    struct obstack strings;
+    char **paths;
+    size_t n, capacity;
+};
+
+struct walker {
+    int base_fd;
+    const char *pat, *pat_end;  /* component to match, or NULL to match all */
+    bool dot;                   /* pat matches hidden names */
+    bool need_dir;              /* only directories match: pat is followed
+                                   by more components, or ** by a / */
+    int nthreads;
+    struct walk_deque *deques;
+    struct walk_results *results;
+    atomic_size_t pending;      /* directories queued or being read */
+    atomic_ulong generation;    /* changes when work is queued or the walk ends */
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+};
+
+struct walk_thread {
+    struct walker *w;
+    int self;
+    pthread_t thread;
+};
+
+static void
+deque_push(struct walk_deque *d, struct walk_item *item)
+{
+    pthread_mutex_lock(&d->lock);
+    if (d->tail == d->capacity) {
+        if (d->head > 0) {
+            memmove(d->items, d->items + d->head, (d->tail - d->head) * sizeof *d->items);
+            d->tail -= d->head;
+            d->head = 0;
+        } else {
+            d->items = realloc(d->items, (d->capacity = 2 * d->capacity + 64) * sizeof *d->items);
+        }
+    }
+    d->items[d->tail++] = item;
+    pthread_mutex_unlock(&d->lock);
+}
+
+/* Take the newest item ('steal' false) or the oldest one */
+static struct walk_item *
+deque_take(struct walk_deque *d, bool steal)
+{
+    struct walk_item *item = NULL;
+    pthread_mutex_lock(&d->lock);
+    if (d->tail > d->head)
+        item = steal ? d->items[d->head++] : d->items[--d->tail];
+    pthread_mutex_unlock(&d->lock);
+    return item;
+}
+
+/* Wake up a thread waiting for work, or 'all' of them */
+static void
+walker_wake(struct walker *w, bool all)
+{
+    pthread_mutex_lock(&w->idle_lock);
+    atomic_fetch_add(&w->generation, 1);
+    if (all)
+        pthread_cond_broadcast(&w->idle_cond);
+    else
+        pthread_cond_signal(&w->idle_cond);
+    pthread_mutex_unlock(&w->idle_lock);
+}
+
+static void
+walker_queue(struct walker *w, int self, const char *path, size_t len)
+{
+    struct walk_item *item = malloc(sizeof *item + len + 1);
+    item->len = len;
+    memcpy(item->path, path, len);
+    item->path[len] = '\0';
+
+    atomic_fetch_add(&w->pending, 1);
+    deque_push(&w->deques[self], item);
+    walker_wake(w, false);
+}
+
+/* Return the next directory for thread 'self' to read, stealing one if
+ * its own deque is empty, or NULL once the whole tree has been read. */
+static struct walk_item *
+walker_take(struct walker *w, int self)
+{
+    for (;;) {
+        unsigned long generation = atomic_load(&w->generation);
+
+        struct walk_item *item = deque_take(&w->deques[self], false);
+        for (int i = 1; item == NULL && i < w->nthreads; i++)
+            item = deque_take(&w->deques[(self + i) % w->nthreads], true);
+        if (item)
+            return item;
+
+        pthread_mutex_lock(&w->idle_lock);
+        while (generation == atomic_load(&w->generation) && atomic_load(&w->pending) > 0)
+            pthread_cond_wait(&w->idle_cond, &w->idle_lock);
+        bool done = atomic_load(&w->pending) == 0;
+        pthread_mutex_unlock(&w->idle_lock);
+        if (done)
+            return NULL;
+    }
+}
+
+static void
+walk_result(struct walk_results *r, const char *dir, size_t len, const char *name)
+{
+    if (r->n == r->capacity)
+        r->paths = realloc(r->paths, (r->capacity = 2 * r->capacity + 64) * sizeof *r->paths);
+    obstack_grow(&r->strings, dir, len);
+    r->paths[r->n++] = obstack_copy0(&r->strings, name, strlen(name));
+}
+
+/* Read one directory: record the entries that match, and queue the
+ * subdirectories */
+static void
+walk_directory(struct walker *w, int self, struct walk_item *item, char *buf)
+{
+    int fd = openat(w->base_fd, item->len ? item->path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+        return;
+
+    char path[PATH_MAX];
+    memcpy(path, item->path, item->len);
+
+    ssize_t len;
+    while ((len = getdents64(fd, buf, DENTS_BUFSIZE)) > 0) {
+        for (char *p = buf; p < buf + len; p += ((struct dirent64 *) p)->d_reclen) {
+            struct dirent64 *d = (struct dirent64 *) p;
+            const char *name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                continue;
+
+            struct stat st;
+            unsigned char type = d->d_type;
+            if (type == DT_UNKNOWN && fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+                type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISLNK(st.st_mode) ? DT_LNK : DT_REG;
+
+            bool hidden = name[0] == '.';
+            bool match = w->pat == NULL ? !hidden
+                         : (!hidden || w->dot) && pattern_match(w->pat, w->pat_end, name);
+            if (match && w->need_dir)
+                match = type == DT_DIR
+                        || (type == DT_LNK && fstatat(fd, name, &st, 0) == 0 && S_ISDIR(st.st_mode));
+            if (match)
+                walk_result(&w->results[self], item->path, item->len, name);
+
+            size_t namelen = strlen(name);
+            if (type == DT_DIR && !hidden && item->len + namelen + 1 < PATH_MAX) {
+                memcpy(path + item->len, name, namelen);
+                path[item->len + namelen] = '/';
+                walker_queue(w, self, path, item->len + namelen + 1);
+            }
+        }
+    }
+    close(fd);
+}
+
+static void *
+walk_thread(void *arg)
+{
+    struct walk_thread *t = arg;
+    struct walker *w = t->w;
+    char *buf = malloc(DENTS_BUFSIZE);
+
+    struct walk_item *item;
+    while ((item = walker_take(w, t->self)) != NULL) {
+        walk_directory(w, t->self, item, buf);
+        free(item);
+        if (atomic_fetch_sub(&w->pending, 1) == 1)
+            walker_wake(w, true);
+    }
+    free(buf);
+    return NULL;
+}
+
+/* Return the number of threads to walk a tree with.  Reading directories
+ * mostly waits for the disk or the network, so use more than one thread
+ * per CPU. */
+static int
+walk_thread_count(void)
+{
+    long n = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+    return n < 2 ? 2 : n > WALK_MAX_THREADS ? WALK_MAX_THREADS : n;
+}
+
+static void glob_from(struct glob_state *g, size_t len, const char *pat, bool magic);
+
+/* Match 'rest', the pattern after a ** component, in the whole tree
+ * below the first 'len' bytes of g->path */
+static void
+glob_walk(struct glob_state *g, size_t len, const char *rest)
+{
+    /* ** / ** is the same as ** */
+    while (rest[0] == '/' && rest[1] == '*' && rest[2] == '*' && (rest[3] == '/' || rest[3] == '\0'))
+        rest += 3;
+    bool trailing_slash = *rest == '/';
+    while (*rest == '/')
+        rest++;
+
+    /* A ** followed only by slashes matches directories only, and the
+     * matches keep a trailing slash */
+    struct walker w = { .pat = NULL, .need_dir = trailing_slash };
+    if (*rest) {
+        w.pat = rest;
+        w.pat_end = strchrnul(rest, '/');
+        w.dot = *rest == '.' || (rest[0] == '\\' && rest[1] == '.');
+        w.need_dir = *w.pat_end == '/';
+    }
+
+    g->path[len] = '\0';
+    w.base_fd = open(len ? g->path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (w.base_fd == -1)
+        return;
+
+    int nthreads = w.nthreads = walk_thread_count();
+    w.deques = calloc(nthreads, sizeof *w.deques);
+    w.results = calloc(nthreads, sizeof *w.results);
+    struct walk_thread threads[WALK_MAX_THREADS];
+    for (int i = 0; i < nthreads; i++) {
+        pthread_mutex_init(&w.deques[i].lock, NULL);
+        obstack_init(&w.results[i].strings);
+        threads[i].w = &w;
+        threads[i].self = i;
+    }
+    atomic_init(&w.pending, 0);
+    atomic_init(&w.generation, 0);
+    pthread_mutex_init(&w.idle_lock, NULL);
+    pthread_cond_init(&w.idle_cond, NULL);
+
+    walker_queue(&w, 0, "", 0);
+
+    /* This thread is worker 0.  The others block all signals, so that
+     * the shell's handlers only ever run on this thread. */
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    int started = 1;
+    while (started < nthreads && pthread_create(&threads[started].thread, NULL,
+                                                  walk_thread, &threads[started]) == 0)
+        started++;
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    walk_thread(&threads[0]);
+    for (int i = 1; i < started; i++)
+        pthread_join(threads[i].thread, NULL);
+    close(w.base_fd);
+
+    /* A trailing ** also matches the directory it starts from */
+    if (w.pat == NULL && len > 0)
+        add_match(g, len);
+
+    /* Continue with the rest of the pattern below each match */
+    const char *after = w.pat ? w.pat_end : trailing_slash ? "/" : "";
+    for (int i = 0; i < nthreads; i++) {
+        struct walk_results *r = &w.results[i];
+        for (size_t j = 0; j < r->n; j++) {
+            size_t n = strlen(r->paths[j]);
+            if (len + n >= PATH_MAX)
+                continue;
+            memcpy(g->path + len, r->paths[j], n);
+            if (*after)
+                glob_from(g, len + n, after, true);
+            else
+                add_match(g, len + n);
+        }
+        obstack_free(&r->strings, NULL);
+        free(r->paths);
+        free(w.deques[i].items);
+        pthread_mutex_destroy(&w.deques[i].lock);
+    }
+    free(w.results);
+    free(w.deques);
+    pthread_mutex_destroy(&w.idle_lock);
+    pthread_cond_destroy(&w.idle_cond);
+}
+
+/* Match the rest of the pattern, 'pat', below the first 'len' bytes
+ * of g->path.  'magic' is true if a wildcard component has been
+ * matched, so that the path is known to exist only up to there. */
+static void
+glob_from(struct glob_state *g, size_t len, const char *pat, bool magic)
+{
+    while (*pat == '/') {
+        if (len >= PATH_MAX - 1)
+            return;
+        g->path[len++] = *pat++;
+    }
+
+    if (*pat == '\0') {
+        g->path[len] = '\0';
+        struct stat st;
+        if (!magic || lstat(g->path, &st) == 0)
+            add_match(g, len);
+        return;
+    }
+
+    const char *end = strchrnul(pat, '/');
+    if (end - pat == 2 && pat[0] == '*' && pat[1] == '*') {
+        glob_walk(g, len, end);
+        return;
+    }
+    if (!component_has_magic(pat, end)) {
+        size_t n = append_literal(g, len, pat, end);
+        if (n > 0)
+            glob_from(g, n, end, magic);
+        return;
+    }
+
+    g->path[len] = '\0';
+    struct dir_listing *dir = dir_listing_get(len ? g->path : ".");
+    if (dir == NULL)
+        return;
+
+    /* Hidden names only match a pattern that starts with a dot */
+    bool dot = *pat == '.' || (pat[0] == '\\' && pat[1] == '.');
+    for (size_t i = 0; i < dir->nentries; i++) {
+        const char *name = dir->names + dir->entries[i].name;
+        if ((*name == '.' && !dot) || !pattern_match(pat, end, name))
+            continue;
+
+        size_t namelen = strlen(name);
+        if (len + namelen >= PATH_MAX)
+            continue;
+        memcpy(g->path + len, name, namelen + 1);
+        if (*end == '/' && !entry_is_dir(g, dir->entries[i].type))
+            continue;
+        glob_from(g, len + namelen, end, true);
+    }
+    dir_listing_unref(dir);
+}
+
+static int
+compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+size_t
+glob_expand(const char *pattern, struct obstack *strings, struct obstack *vectors)
+{
+    if (!glob_has_magic(pattern))
+        return 0;
+
+    struct glob_state *g = malloc(sizeof *g);
+    g->matches = NULL;
+    g->nmatches = g->capacity = 0;
+    g->strings = strings;
+    glob_from(g, 0, pattern, false);
+
+    if (g->nmatches > 0) {
+        qsort(g->matches, g->nmatches, sizeof *g->matches, compare_paths);
+        obstack_grow(vectors, g->matches, g->nmatches * sizeof *g->matches);
+    }
+
+    size_t n = g->nmatches;
+    free(g->matches);
+    free(g);
+    return n;
+}
@@ -0,0 +1,22 @@
+#ifndef __GLOBBING_H
+#define __GLOBBING_H
+
+#include <obstack.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Return true if 'pattern' contains an unescaped *, ? or [...] */
+bool glob_has_magic(const char *pattern);
+
+/* Expand 'pattern' into the pathnames that match it, in sorted order.
+ * A backslash in the pattern makes the next character literal.
+ * The pathnames are allocated in 'strings' and pointers to them are
+ * appended to the object being grown in 'vectors'.
+ * Returns the number of pathnames, 0 if nothing matched.
+ */
+size_t glob_expand(const char *pattern, struct obstack *strings, struct obstack *vectors);
+
+/* Drop all cached directory listings */
+void glob_cache_clear(void);
+
+#endif /* __GLOBBING_H */
@@ -0,0 +1,636 @@
+/*
+ * The shell's history, persisted, deduplicated and indexed for history
+ * expansion and search.
+ *
+ * With a history file, every entry is appended to it with a single
+ * write to a descriptor opened with O_APPEND, which the kernel performs
+ * atomically with respect to other appends, so any number of shells can
+ * share one file; the file is the history, and entries are numbered by
+ * their position in it.  Nothing is read when the file is opened.
+ * hist_sync maps the part of the file that has not been seen yet and
+ * adds its lines; it is called when the history is first used and later
+ * picks up the entries appended since, by this shell or others.
+ *
+ * In memory, identical lines are stored once: a hash set interns every
+ * distinct line, and an entry is only a reference to its line and the
+ * time it was added, so a command repeated a thousand times costs a
+ * thousand small entries, not a thousand copies.  Everything is charged
+ * to a byte budget, and the oldest entries are evicted when it is
+ * exceeded; a line goes when its last entry does.
+ *
+ * The text of the distinct lines is kept in one arena, NUL terminated,
+ * in the order in which they were last used: a line that is used again
+ * is moved to the end and its old copy blanked with NULs.  The ^R search
+ * (hist_search) scans the arena backwards, using SSE2 to compare 16
+ * positions at a time, and finds every distinct line once, at its
+ * newest entry.  The arena is compacted when more than half of it is
+ * blank.
+ *
+ * For !prefix, every line is also inserted into a radix trie (a trie
+ * whose single-child chains are merged into one node with a multi-byte
+ * label) in which each node records the number of the newest entry
+ * below it.  Since entries are only ever added with a number higher
+ * than all before, inserting a line simply stamps its number on every
+ * node of its path, and a lookup walks the prefix and reads the number
+ * off the node where it ends; a number older than the oldest entry
+ * means that everything below was evicted.  The trie is built on the
+ * first !prefix; its nodes come from an obstack, so that a path created
+ * by one insertion is mostly contiguous, and it is dropped and rebuilt
+ * once it holds more evicted lines than live ones.
+ */
+#define _GNU_SOURCE 1
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <obstack.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "hist.h"
+
+#define obstack_chunk_alloc malloc
+#define obstack_chunk_free free
+
+struct trie_node {
+    struct trie_node *child;    /* first child */
+    struct trie_node *sibling;  /* next child of the same parent */
+    int newest;                 /* newest entry at or below this node */
+    unsigned len;
+    char label[];               /* 'len' bytes, not NUL terminated */
+};
+
+static struct trie_node root;
+static struct obstack trie_arena;   /* nodes, which are never freed */
+static bool trie_arena_ready;
+static int indexed = 1;         /* the first entry not in the trie */
+static int trie_stale;          /* lines in the trie that were evicted */
+
+/* A distinct line */
+struct hist_line {
+    struct hist_line *next;     /* in the same bucket of the hash set */
+    uint32_t hash;
+    int refs;                   /* entries that are this line */
+    int newest;                 /* the newest of them */
+    int slot;                   /* index in 'slots' */
+    size_t offset;              /* of the text in the arena */
+    size_t len;
+};
+
+struct hist_entry {
+    struct hist_line *line;
+    time_t when;
+};
+
+/* The entries, oldest first: entry n is entries[head + n - first] */
+static struct hist_entry *entries;
+static int head, nentries, entries_capacity;
+static int first = 1;
+
+/* The hash set of distinct lines */
+static struct hist_line **buckets;
+static size_t nbuckets;
+static int ndistinct;
+
+/* The arena holding the text of the lines, in the order they were last
+ * used, and for each line in it, where it starts.  A slot whose line
+ * has moved or gone is NULL but keeps its offset, so the slots remain
+ * sorted by offset. */
+static char *arena;
+static size_t arena_used, arena_capacity, arena_blank;
+static struct slot {
+    size_t offset;
+    struct hist_line *line;
+} *slots;
+static int nslots, slots_capacity;
+
+#define HIST_DEFAULT_BUDGET (4 << 20)
+static size_t budget = HIST_DEFAULT_BUDGET;
+static size_t charged;          /* bytes of lines and entries */
+
+static int log_fd = -1;         /* the history file, if any */
+static off_t log_seen;          /* bytes of it added as entries */
+
+static struct trie_node *
+new_node(const char *label, size_t len, int newest)
+{
+    if (!trie_arena_ready) {
+        obstack_init(&trie_arena);
+        trie_arena_ready = true;
+    }
+    struct trie_node *node = obstack_alloc(&trie_arena, sizeof *node + len);
+    node->child = node->sibling = NULL;
+    node->newest = newest;
+    node->len = len;
+    memcpy(node->label, label, len);
+    return node;
+}
+
+/* Return the link to the child of 'node' whose label starts with 'c',
+ * or to the NULL at the end of its children */
+static struct trie_node **
+find_child(struct trie_node *node, char c)
+{
+    struct trie_node **link = &node->child;
+    while (*link && (*link)->label[0] != c)
+        link = &(*link)->sibling;
+    return link;
+}
+
+/* Return the number of leading bytes that 'node's label and 's' share */
+static size_t
+common_length(const struct trie_node *node, const char *s)
+{
+    size_t k = 0;
+    while (k < node->len && s[k] == node->label[k])
+        k++;
+    return k;
+}
+
+static void
+trie_insert(const char *s, int n)
+{
+    struct trie_node *node = &root;
+    node->newest = n;
+    while (*s) {
+        struct trie_node **link = find_child(node, *s);
+        if (*link == NULL) {
+            *link = new_node(s, strlen(s), n);
+            return;
+        }
+
+        struct trie_node *child = *link;
+        size_t k = common_length(child, s);
+        if (k < child->len) {
+            /* Split the child's label: the shared part becomes a new
+             * node above it */
+            struct trie_node *mid = new_node(child->label, k, child->newest);
+            mid->child = child;
+            mid->sibling = child->sibling;
+            child->sibling = NULL;
+            child->len -= k;
+            memmove(child->label, child->label + k, child->len);
+            *link = child = mid;
+        }
+        child->newest = n;
+        node = child;
+        s += k;
+    }
+}
+
+/* Drop the trie, to be rebuilt from the live entries when needed */
+static void
+trie_reset(void)
+{
+    if (trie_arena_ready) {
+        obstack_free(&trie_arena, NULL);
+        trie_arena_ready = false;
+    }
+    root = (struct trie_node) { 0 };
+    indexed = first;
+    trie_stale = 0;
+}
+
+static struct hist_entry *
+entry(int n)
+{
+    return &entries[head + n - first];
+}
+
+static const char *
+line_text(const struct hist_line *line)
+{
+    return arena + line->offset;
+}
+
+int
+hist_find_prefix(const char *prefix)
+{
+    /* The trie is only built once it is needed */
+    if (indexed < first)
+        indexed = first;
+    for (; indexed < first + nentries; indexed++)
+        trie_insert(line_text(entry(indexed)->line), indexed);
+
+    struct trie_node *node = &root;
+    const char *p = prefix;
+    while (*p) {
+        struct trie_node *child = *find_child(node, *p);
+        if (child == NULL)
+            return 0;
+
+        size_t k = common_length(child, p);
+        if (k < child->len && p[k] != '\0')
+            return 0;
+        node = child;       /* the prefix may end inside this node */
+        p += k;
+    }
+    return node->newest >= first ? node->newest : 0;
+}
+
+/* 32-bit FNV-1a */
+static uint32_t
+hash_line(const char *s, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char) s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Make the hash set have at least 'want' buckets */
+static void
+resize_buckets(size_t want)
+{
+    size_t n = nbuckets ? nbuckets : 256;
+    while (n < want)
+        n *= 2;
+    if (n == nbuckets)
+        return;
+
+    struct hist_line **b = calloc(n, sizeof *b);
+    for (size_t i = 0; i < nbuckets; i++) {
+        for (struct hist_line *line = buckets[i], *next; line; line = next) {
+            next = line->next;
+            line->next = b[line->hash & (n - 1)];
+            b[line->hash & (n - 1)] = line;
+        }
+    }
+    free(buckets);
+    buckets = b;
+    nbuckets = n;
+}
+
+/* Move the live lines to the start of the arena, in order */
+static void
+compact_arena(void)
+{
+    size_t used = 0;
+    int n = 0;
+    for (int i = 0; i < nslots; i++) {
+        struct hist_line *line = slots[i].line;
+        if (line == NULL)
+            continue;
+        memmove(arena + used, arena + line->offset, line->len + 1);
+        line->offset = used;
+        line->slot = n;
+        slots[n++] = (struct slot) { .offset = used, .line = line };
+        used += line->len + 1;
+    }
+    arena_used = used;
+    arena_blank = 0;
+    nslots = n;
+}
+
+/* Make room for 'len' more bytes and one more slot at the end of the
+ * arena.  Lines may move. */
+static void
+reserve_arena(size_t len)
+{
+    if (arena_blank > arena_used / 2 && arena_blank > 65536)
+        compact_arena();
+    if (arena_used + len > arena_capacity) {
+        while (arena_used + len > arena_capacity)
+            arena_capacity = arena_capacity ? 2 * arena_capacity : 65536;
+        arena = realloc(arena, arena_capacity);
+    }
+    if (nslots == slots_capacity) {
+        slots_capacity = slots_capacity ? 2 * slots_capacity : 1024;
+        slots = realloc(slots, slots_capacity * sizeof *slots);
+    }
+}
+
+/* Blank the text of 'line' where it is now */
+static void
+blank_line(struct hist_line *line)
+{
+    memset(arena + line->offset, '\0', line->len + 1);
+    slots[line->slot].line = NULL;
+    arena_blank += line->len + 1;
+}
+
+/* Copy the text at 's', which is 'line->len' bytes outside the arena,
+ * to the end of the arena as the text of 'line' */
+static void
+place_line(struct hist_line *line, const char *s)
+{
+    reserve_arena(line->len + 1);
+    line->offset = arena_used;
+    line->slot = nslots;
+    memcpy(arena + arena_used, s, line->len);
+    arena[arena_used + line->len] = '\0';
+    slots[nslots++] = (struct slot) { .offset = arena_used, .line = line };
+    arena_used += line->len + 1;
+}
+
+/* Move the text of 'line' to the end of the arena */
+static void
+move_line(struct hist_line *line)
+{
+    if (line->slot == nslots - 1)
+        return;
+
+    reserve_arena(line->len + 1);
+    size_t offset = arena_used;
+    memcpy(arena + offset, arena + line->offset, line->len + 1);
+    blank_line(line);
+    line->offset = offset;
+    line->slot = nslots;
+    slots[nslots++] = (struct slot) { .offset = offset, .line = line };
+    arena_used += line->len + 1;
+}
+
+static void
+free_line(struct hist_line *line)
+{
+    struct hist_line **link = &buckets[line->hash & (nbuckets - 1)];
+    while (*link != line)
+        link = &(*link)->next;
+    *link = line->next;
+
+    blank_line(line);
+    charged -= sizeof *line + line->len + 1;
+    ndistinct--;
+    free(line);
+    if (trie_arena_ready && ++trie_stale > ndistinct)
+        trie_reset();
+}
+
+/* Return the line with the 'len' bytes of text at 's', adding it if it
+ * is new, and make it the last one in the arena */
+static struct hist_line *
+intern_line(const char *s, size_t len)
+{
+    uint32_t hash = hash_line(s, len);
+    if (nbuckets > 0) {
+        for (struct hist_line *line = buckets[hash & (nbuckets - 1)]; line; line = line->next) {
+            if (line->hash == hash && line->len == len
+                && memcmp(line_text(line), s, len) == 0) {
+                move_line(line);
+                return line;
+            }
+        }
+    }
+
+    if (ndistinct >= nbuckets)
+        resize_buckets(2 * nbuckets);
+    struct hist_line *line = malloc(sizeof *line);
+    line->hash = hash;
+    line->refs = 0;
+    line->len = len;
+    line->next = buckets[hash & (nbuckets - 1)];
+    buckets[hash & (nbuckets - 1)] = line;
+    ndistinct++;
+    place_line(line, s);
+    charged += sizeof *line + len + 1;
+    return line;
+}
+
+/* Remove the oldest entry */
+static void
+evict_oldest(void)
+{
+    struct hist_line *line = entries[head].line;
+    head++;
+    nentries--;
+    first++;
+    charged -= sizeof *entries;
+    if (--line->refs == 0)
+        free_line(line);
+}
+
+/* Add the 'len' bytes at 'line' as the newest entry */
+static void
+add_entry(const char *line, size_t len, time_t when)
+{
+    if (head + nentries == entries_capacity) {
+        if (head > 0 && head >= entries_capacity / 2) {
+            memmove(entries, entries + head, nentries * sizeof *entries);
+            head = 0;
+        } else {
+            entries_capacity = entries_capacity ? 2 * entries_capacity : 64;
+            entries = realloc(entries, entries_capacity * sizeof *entries);
+        }
+    }
+
+    int n = first + nentries;
+    struct hist_line *l = intern_line(line, len);
+    l->refs++;
+    l->newest = n;
+    entries[head + nentries++] = (struct hist_entry) { .line = l, .when = when };
+    charged += sizeof *entries;
+
+    /* The newest entry is kept, however long its line */
+    while (charged > budget && nentries > 1)
+        evict_oldest();
+}
+
+void
+hist_set_budget(size_t bytes)
+{
+    budget = bytes;
+    while (charged > budget && nentries > 1)
+        evict_oldest();
+}
+
+void
+hist_open(const char *path)
+{
+    log_fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+}
+
+void
+hist_sync(void)
+{
+    struct stat st;
+    if (log_fd == -1 || fstat(log_fd, &st) == -1 || st.st_size <= log_seen)
+        return;
+
+    /* Map the new part from the page it starts in */
+    off_t start = log_seen & ~(off_t) (sysconf(_SC_PAGESIZE) - 1);
+    size_t size = st.st_size - start;
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, log_fd, start);
+    if (map == MAP_FAILED)
+        return;
+
+    /* A line another shell is still writing has no newline yet; it is
+     * picked up the next time.  The file does not record when entries
+     * were added, so those read from it are dated by its last change. */
+    char *p = map + (log_seen - start), *end = map + size, *nl;
+
+    /* Every entry costs at least sizeof *entries, so of more new lines
+     * than the budget has room for, the older ones would be evicted
+     * again at once, with all the entries before them: count them
+     * instead of adding them. */
+    size_t nnew = 0, keep = budget / sizeof *entries + 1;
+    for (char *q = p; (nl = memchr(q, '\n', end - q)) != NULL; q = nl + 1)
+        nnew++;
+    if (nnew > keep) {
+        while (nentries > 0)
+            evict_oldest();
+        for (; nnew > keep; nnew--) {
+            p = (char *) memchr(p, '\n', end - p) + 1;
+            first++;
+        }
+    }
+
+    /* Size the hash set for the new lines at once, but for no more
+     * distinct lines than the budget can hold */
+    size_t most = budget / (sizeof (struct hist_line) + sizeof *entries);
+    resize_buckets(ndistinct + (nnew < most ? nnew : most));
+
+    while ((nl = memchr(p, '\n', end - p)) != NULL) {
+        add_entry(p, nl - p, st.st_mtime);
+        p = nl + 1;
+    }
+    log_seen = start + (p - map);
+    munmap(map, size);
+}
+
+void
+hist_add(const char *line)
+{
+    if (*line == '\0')
+        return;
+
+    if (log_fd == -1) {
+        add_entry(line, strlen(line), time(NULL));
+        return;
+    }
+
+    struct iovec iov[2] = {
+        { .iov_base = (char *) line, .iov_len = strlen(line) },
+        { .iov_base = "\n", .iov_len = 1 },
+    };
+    if (writev(log_fd, iov, 2) == -1) {
+        /* Keep the entry in memory at least */
+        add_entry(line, strlen(line), time(NULL));
+    }
+}
+
+const char *
+hist_get(int n)
+{
+    if (n < first || n >= first + nentries)
+        return NULL;
+    return line_text(entry(n)->line);
+}
+
+time_t
+hist_time(int n)
+{
+    if (n < first || n >= first + nentries)
+        return 0;
+    return entry(n)->when;
+}
+
+int
+hist_first(void)
+{
+    return first;
+}
+
+int
+hist_last(void)
+{
+    return first + nentries - 1;
+}
+
+/* Return the last occurrence of the 'm' bytes at 'needle' that lies
+ * entirely within [start, end), or NULL */
+static const char *
+find_last_scalar(const char *start, const char *end, const char *needle, size_t m)
+{
+    const char *limit = end - m + 1;    /* occurrences start before it */
+    while (limit > start) {
+        const char *p = memrchr(start, needle[0], limit - start);
+        if (p == NULL)
+            return NULL;
+        if (memcmp(p, needle, m) == 0)
+            return p;
+        limit = p;
+    }
+    return NULL;
+}
+
+#ifdef __SSE2__
+/* The same, 16 starting positions at a time: a position is a candidate
+ * if both the first and the last byte of the needle match there, which
+ * rules out almost all positions before any memcmp. */
+static const char *
+find_last(const char *start, const char *end, const char *needle, size_t m)
+{
+    const __m128i first_byte = _mm_set1_epi8(needle[0]);
+    const __m128i last_byte = _mm_set1_epi8(needle[m - 1]);
+
+    /* Each block covers the 16 starting positions before 'limit' */
+    const char *limit = end - m + 1;
+    while (limit - start >= 16) {
+        const char *block = limit - 16;
+        __m128i f = _mm_loadu_si128((const __m128i *) block);
+        __m128i l = _mm_loadu_si128((const __m128i *) (block + m - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(f, first_byte),
+                                                        _mm_cmpeq_epi8(l, last_byte)));
+        while (mask) {
+            int bit = 31 - __builtin_clz(mask);
+            if (memcmp(block + bit + 1, needle + 1, m - 1) == 0)
+                return block + bit;
+            mask &= ~(1u << bit);
+        }
+        limit = block;
+    }
+    return find_last_scalar(start, limit + m - 1, needle, m);
+}
+#else
+#define find_last find_last_scalar
+#endif
+
+/* Return the line whose text contains the arena byte at 'offset' */
+static struct hist_line *
+line_at(size_t offset)
+{
+    /* Find the last slot that starts at or before 'offset'.  Blank text
+     * never matches, so that slot is live. */
+    int lo = 0, hi = nslots - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (slots[mid].offset <= offset)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return slots[lo].line;
+}
+
+int
+hist_search(const char *needle, int before)
+{
+    size_t m = strlen(needle);
+    if (m == 0 || nentries == 0 || before <= first)
+        return 0;
+
+    /* The lines last used before 'before' all precede its line, if it
+     * was last used there */
+    const char *end = arena + arena_used;
+    if (before < first + nentries && entry(before)->line->newest == before)
+        end = line_text(entry(before)->line);
+
+    while (end - arena >= m) {
+        const char *p = find_last(arena, end, needle, m);
+        if (p == NULL)
+            return 0;
+        struct hist_line *line = line_at(p - arena);
+        if (line->newest < before)
+            return line->newest;
+        end = line_text(line);
+    }
+    return 0;
+}
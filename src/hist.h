@@ -0,0 +1,60 @@
+#ifndef __HIST_H
+#define __HIST_H
+
+#include <stddef.h>
+#include <time.h>
+
+/* The shell's history.  Entries are numbered from 1 in the order they
+ * were added, as readline numbers them with its default history_base,
+ * so the numbers printed by the history builtin are the ones !N takes.
+ * With a history file, the numbers are positions in that file and are
+ * the same in every shell that shares it.  The oldest entries are
+ * dropped from memory once the history exceeds its byte budget, after
+ * which hist_first() is higher than 1.
+ */
+
+/* Keep the history in the file at 'path', which may be shared with
+ * other shells.  The file is not read until hist_sync is called. */
+void hist_open(const char *path);
+
+/* Pick up the entries that were added to the history file since the
+ * last call, by this shell or by others.  The functions below only see
+ * the entries as of the last call. */
+void hist_sync(void);
+
+/* Add 'line' as the newest entry, unless it is empty.  With a history
+ * file, the entry is only appended to the file, and is numbered when
+ * hist_sync picks it up. */
+void hist_add(const char *line);
+
+/* Limit the memory used by the history to about 'bytes', evicting the
+ * oldest entries as needed.  Identical lines are stored once, so an
+ * entry that repeats an earlier line only costs a few bytes. */
+void hist_set_budget(size_t bytes);
+
+/* Return the line of entry 'n', or NULL if there is no such entry.
+ * The line remains valid until the next call to hist_add or hist_sync. */
+const char *hist_get(int n);
+
+/* Return when entry 'n' was added, or 0 if there is no such entry.
+ * Entries read from the history file are dated by its last change. */
+time_t hist_time(int n);
+
+/* The numbers of the oldest and the newest entry; if the history is
+ * empty, hist_last() is hist_first() - 1 */
+int hist_first(void);
+int hist_last(void);
+
+/* Return the number of the newest entry that starts with 'prefix',
+ * or 0 if there is none.  Takes time proportional to the length of
+ * 'prefix', not to the size of the history. */
+int hist_find_prefix(const char *prefix);
+
+/* Return the number of the newest entry before entry 'before' whose
+ * line contains 'needle', or 0 if there is none.  A line is only found
+ * at its newest entry, so that searching backwards from each result
+ * visits every distinct line once.  Scans the history newest first, at
+ * memory speed. */
+int hist_search(const char *needle, int before);
+
+#endif /* __HIST_H */
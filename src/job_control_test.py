@@ -0,0 +1,99 @@
+#!/usr/bin/python
+#
+# Tests wait and kill with job specs: the status wait returns for a
+# job, for any job with -n, for a stopped and for an unknown job; kill
+# with %+, ranges and lists; and fg on a job whose process has
+# children of its own.
+#
+import atexit, proc_check, time
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+#################################################################
+# Step 1. wait %N returns the status of job N; a job that does not
+# exist gives status 127.
+#
+sendline("sh -c 'exit 3' &")
+expect_prompt("Shell did not print expected prompt (2)")
+
+sendline("wait %1; echo st=$?")
+expect_exact("st=3", "wait %1 did not return the status of the job")
+expect_prompt("Shell did not print expected prompt (3)")
+
+sendline("wait %9; echo st=$?")
+expect_exact("st=127", "wait did not give status 127 for an unknown job")
+expect_prompt("Shell did not print expected prompt (4)")
+
+#################################################################
+# Step 2. wait -n returns once one of the jobs is done, with its
+# status, while the other one keeps running.
+#
+sendline("sleep 30 &")
+expect_prompt("Shell did not print expected prompt (5)")
+
+sendline("sh -c 'sleep 0.5; exit 4' &")
+expect_prompt("Shell did not print expected prompt (6)")
+
+sendline("wait -n; echo st=$?")
+expect_exact("st=4", "wait -n did not return the status of the job that finished")
+expect_prompt("Shell did not print expected prompt (7)")
+
+#################################################################
+# Step 3. wait returns when the job it waits for stops, with 128 plus
+# the signal, and kill -KILL ends the stopped job.
+#
+sendline("kill -STOP %1; wait %1; echo st=$?")
+expect_exact("st=147", "wait did not return when the job stopped")
+expect_prompt("Shell did not print expected prompt (8)")
+
+sendline("kill -KILL %1; wait %1; echo st=$?")
+expect_exact("st=137", "kill -KILL did not end the stopped job")
+expect_prompt("Shell did not print expected prompt (9)")
+
+#################################################################
+# Step 4. kill -SIG %+ signals the current job.
+#
+sendline("sleep 30 &")
+expect_prompt("Shell did not print expected prompt (10)")
+
+sendline("kill -TERM %+; wait %+; echo st=$?")
+expect_exact("st=143", "kill -TERM %+ did not terminate the current job")
+expect_prompt("Shell did not print expected prompt (11)")
+
+#################################################################
+# Step 5. kill takes ranges and lists of specs: 1-2,%3 kills the
+# first three of four jobs and leaves the fourth running.
+#
+for i in range(4):
+    sendline("sleep 30 &")
+    expect_prompt("Shell did not print expected prompt (12)")
+
+sendline("kill -KILL 1-2,%3; wait 1-3; echo st=$?; jobs")
+expect_exact("st=137\r\n[4]\tRunning", "kill did not signal the jobs of the range and list")
+expect_prompt("Shell did not print expected prompt (13)")
+
+sendline("kill %4; wait %4; echo st=$?")
+expect_exact("st=143", "kill %4 did not terminate the last job")
+expect_prompt("Shell did not print expected prompt (14)")
+
+#################################################################
+# Step 6. ^Z stops a job whose shell waits for a child of its own,
+# and fg continues both, so the job finishes.
+#
+sendline("sh -c 'sleep 2; echo GRAND$((1 + 1))DONE'")
+wait_for_fg_child()
+sendcontrol('z')
+
+(jobid, statusmsg, cmdline) = parse_job_line()
+assert statusmsg == 'stopped', "Shell did not report stopped job"
+expect_prompt("Shell did not print expected prompt (15)")
+
+run_builtin('fg', jobid)
+expect_exact("GRAND2DONE", "fg did not continue the child of the job")
+expect_prompt("Shell did not print expected prompt (16)")
+
+test_success()
@@ -0,0 +1,73 @@
+#!/usr/bin/python
+#
+# Tests the parallel builtin: items given after :::, {} substitution,
+# keeping the output order with -k, tagging output with --tag, its
+# status and ^C; and the options and status of xargs.
+#
+import atexit, proc_check, time
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+#################################################################
+# Step 1. The output of the jobs is printed in item order with -k,
+# even though the first item finishes last.
+#
+sendline("parallel -j 3 -k sh -c \"sleep 0.{}; echo item{}\" ::: 5 1 3")
+
+expect_exact("item5\r\nitem1\r\nitem3", "parallel -k did not keep the order")
+expect_prompt("Shell did not print expected prompt (2)")
+
+#################################################################
+# Step 2. Without {} the item is appended; --tag prefixes each line.
+#
+sendline("parallel -j 1 --tag echo x ::: a")
+
+expect_exact("a\tx a", "parallel --tag did not tag the output")
+expect_prompt("Shell did not print expected prompt (3)")
+
+#################################################################
+# Step 3. All jobs started by parallel were removed from the job list.
+#
+sendline("jobs")
+expect_exact("There are currently no jobs in the job list.", "parallel left jobs behind")
+expect_prompt("Shell did not print expected prompt (4)")
+
+#################################################################
+# Step 4. xargs takes attached option values, and its status is 123
+# if a command failed and 127 if the command was not found.
+#
+sendline("echo a b | xargs -P2 -n1 echo x | sort")
+expect_exact("x a\r\nx b", "xargs -P2 -n1 did not run one command per item")
+expect_prompt("Shell did not print expected prompt (5)")
+
+sendline("echo a | xargs false; echo st=$?")
+expect_exact("st=123", "xargs did not report the failed command")
+expect_prompt("Shell did not print expected prompt (6)")
+
+sendline("echo a | xargs cush-no-such-command; echo st=$?")
+expect_exact("st=127", "xargs did not report the missing command")
+expect_prompt("Shell did not print expected prompt (7)")
+
+#################################################################
+# Step 5. parallel's status is the number of jobs that failed; ^C
+# interrupts its jobs, gives status 130 and leaves no job behind.
+#
+sendline("parallel false ::: a b; echo st=$?")
+expect_exact("st=2", "parallel did not count the failed jobs")
+expect_prompt("Shell did not print expected prompt (8)")
+
+sendline("parallel -j 2 sleep ::: 30 30 30; echo st=$?")
+time.sleep(1)
+sendintr()
+expect_exact("st=130", "^C did not interrupt parallel")
+expect_prompt("Shell did not print expected prompt (9)")
+
+sendline("jobs")
+expect_exact("There are currently no jobs in the job list.", "interrupted parallel left jobs behind")
+expect_prompt("Shell did not print expected prompt (10)")
+
+test_success()
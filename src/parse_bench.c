@@ -0,0 +1,161 @@
+/*
+ * Throughput benchmark for the command line parser.
+ *
+ * Parses every line of a corpus (parse_corpus.txt by default) plus a
+ * set of synthetic long lines, repeatedly, and reports the throughput
+ * in MB/s and lines/s together with the number of allocations per line.
+ * Allocations are counted by linking with -Wl,--wrap=malloc (and calloc,
+ * realloc), see the parse_bench target in the Makefile.
+ *
+ * Usage: parse_bench [-n iterations] [corpus-file]
+ */
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shell-ast.h"
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t n, size_t size);
+void *__wrap_realloc(void *p, size_t size);
+
+static unsigned long allocations;
+
+void *
+__wrap_malloc(size_t size)
+{
+    allocations++;
+    return __real_malloc(size);
+}
+
+void *
+__wrap_calloc(size_t n, size_t size)
+{
+    allocations++;
+    return __real_calloc(n, size);
+}
+
+void *
+__wrap_realloc(void *p, size_t size)
+{
+    allocations++;
+    return __real_realloc(p, size);
+}
+
+struct corpus {
+    char **lines;
+    int nlines;
+    size_t bytes;
+};
+
+static void
+corpus_add(struct corpus *c, char *line)
+{
+    c->lines = realloc(c->lines, (c->nlines + 1) * sizeof *c->lines);
+    c->lines[c->nlines++] = line;
+    c->bytes += strlen(line);
+}
+
+/* Add the non-empty lines of file 'path' */
+static void
+corpus_read(struct corpus *c, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &cap, f)) != -1) {
+        if (len > 0 && line[len - 1] == '\n')
+            line[--len] = '\0';
+        if (len > 0)
+            corpus_add(c, strdup(line));
+    }
+    free(line);
+    fclose(f);
+}
+
+/* Add a line made of 'n' copies of 'piece', separated by 'sep' */
+static void
+corpus_synthesize(struct corpus *c, const char *piece, const char *sep, int n)
+{
+    size_t plen = strlen(piece), slen = strlen(sep);
+    char *line = malloc(n * (plen + slen) + 1), *p = line;
+    for (int i = 0; i < n; i++) {
+        if (i > 0)
+            p = mempcpy(p, sep, slen);
+        p = mempcpy(p, piece, plen);
+    }
+    *p = '\0';
+    corpus_add(c, line);
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main(int ac, char *av[])
+{
+    int iterations = 200;
+    int opt;
+    while ((opt = getopt(ac, av, "n:")) > 0) {
+        switch (opt) {
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n iterations] [corpus-file]\n", av[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    struct corpus corpus = { NULL, 0, 0 };
+    corpus_read(&corpus, optind < ac ? av[optind] : "parse_corpus.txt");
+    corpus_synthesize(&corpus, "word", " ", 10000);
+    corpus_synthesize(&corpus, "cmd --opt=value arg", " | ", 1000);
+    corpus_synthesize(&corpus, "\"a quoted \\\"string\\\" with spaces\"", " ", 2000);
+    corpus_synthesize(&corpus, "sleep 1 > out.txt", " & ", 1000);
+    corpus_synthesize(&corpus, "echo $(date +%s)x", " ; ", 1000);
+
+    /* Parse errors are expected in the corpus; don't time their output. */
+    if (freopen("/dev/null", "w", stderr) == NULL)
+        perror("/dev/null");
+
+    int errors = 0;
+    unsigned long allocs_before = allocations;
+    double start = now();
+    for (int i = 0; i < iterations; i++) {
+        for (int l = 0; l < corpus.nlines; l++) {
+            struct ast_command_line *cmdline = ast_parse_command_line(corpus.lines[l]);
+            if (cmdline)
+                ast_command_line_unref(cmdline);
+            else
+                errors++;
+        }
+    }
+    double elapsed = now() - start;
+    unsigned long allocs = allocations - allocs_before;
+
+    double lines = (double) iterations * corpus.nlines;
+    printf("%d lines, %zu bytes, %d iterations, %d parse errors\n",
+           corpus.nlines, corpus.bytes, iterations, errors / iterations);
+    printf("%.3f s, %.1f MB/s, %.0f lines/s, %.2f allocations/line\n",
+           elapsed, corpus.bytes * (double) iterations / elapsed / 1e6,
+           lines / elapsed, allocs / lines);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,153 @@
+/*
+ * Fuzz target for the command line parser.
+ *
+ * Links only the parser and the AST (shell-grammar.o, shell-ast.o).
+ * Every input is parsed both as an interactive line and as a script.
+ * The AST of an accepted input is checked and walked, and released
+ * again, so that LeakSanitizer reports memory lost on any path,
+ * including parse errors.
+ *
+ * libFuzzer:
+ *   make clean
+ *   make parse_fuzz CC=clang \
+ *        CFLAGS="-g -O1 -fsanitize=fuzzer-no-link,address -DCUSH_LIBFUZZER" \
+ *        LDFLAGS="-fsanitize=fuzzer,address"
+ *   mkdir corpus; split -l 1 parse_corpus.txt corpus/
+ *   ./parse_fuzz corpus/
+ *
+ * AFL, or to replay inputs, build without CUSH_LIBFUZZER; the program
+ * then parses each file named on the command line, or standard input:
+ *   make clean; make parse_fuzz CC=afl-clang-fast
+ *   mkdir seeds; split -l 1 parse_corpus.txt seeds/
+ *   afl-fuzz -i seeds -o findings ./parse_fuzz
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shell-ast.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+/* Check the invariants of a parsed command line and touch every word */
+static void
+check_command_line(struct ast_command_line *cmdline)
+{
+    size_t total = 0;
+
+    assert(cmdline->npipes >= 0);
+    for (int i = 0; i < cmdline->npipes; i++) {
+        struct ast_pipeline *pipe = &cmdline->pipes[i];
+        assert(pipe->ncommands > 0);
+        assert(pipe->cmdline == cmdline);
+        for (int j = 0; j < pipe->ncommands; j++) {
+            char **argv = pipe->commands[j].argv;
+            assert(argv[0] != NULL);
+            for (char **w = argv; *w; w++)
+                total += strlen(*w);
+        }
+        if (pipe->iored_input)
+            total += strlen(pipe->iored_input);
+        if (pipe->iored_output)
+            total += strlen(pipe->iored_output);
+    }
+    /* The code only refers to pipelines and loops that exist, and its
+     * jumps stay within it */
+    for (int pc = 0; pc < cmdline->ncode; pc++) {
+        struct ast_insn insn = cmdline->code[pc];
+        switch (insn.op) {
+        case AST_RUN:
+            assert(insn.arg < cmdline->npipes);
+            break;
+        case AST_JUMP:
+        case AST_JUMP_IF_FAIL:
+        case AST_JUMP_IF_OK:
+        case AST_FOR_NEXT:
+            assert(insn.arg <= cmdline->ncode);
+            break;
+        case AST_FOR_INIT:
+            assert(insn.arg < cmdline->nloops);
+            assert(cmdline->loops[insn.arg].words != NULL);
+            break;
+        case AST_FUNCTION:
+            assert(insn.arg < cmdline->nfunctions);
+            assert(cmdline->functions[insn.arg].start == pc + 1);
+            assert(cmdline->functions[insn.arg].end <= cmdline->ncode);
+            break;
+        case AST_SET_STATUS:
+            break;
+        default:
+            assert(!"unknown opcode");
+        }
+    }
+    assert(cmdline->nloops == 0 || cmdline->loop_depth > 0);
+
+    /* keep the walk from being optimized away */
+    volatile size_t sink = total;
+    (void) sink;
+}
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    /* As a line, the input ends at the first NUL, like a C string. */
+    char *line = malloc(size + 2);
+    memcpy(line, data, size);
+    line[size] = line[size + 1] = '\0';
+
+    struct ast_command_line *cmdline = ast_parse_command_line(line);
+    if (cmdline) {
+        check_command_line(cmdline);
+        ast_command_line_unref(cmdline);
+    }
+
+    /* As a script, it is scanned in place including any NUL bytes. */
+    cmdline = ast_parse_buffer(line, size);
+    if (cmdline) {
+        check_command_line(cmdline);
+        ast_command_line_unref(cmdline);
+    }
+
+    free(line);
+    return 0;
+}
+
+#ifndef CUSH_LIBFUZZER
+/* Read all of 'f' into a buffer */
+static char *
+read_all(FILE *f, size_t *size)
+{
+    size_t cap = 4096;
+    char *buf = malloc(cap);
+    *size = 0;
+    for (;;) {
+        *size += fread(buf + *size, 1, cap - *size, f);
+        if (*size < cap)
+            return buf;
+        buf = realloc(buf, cap *= 2);
+    }
+}
+
+int
+main(int ac, char *av[])
+{
+    /* Parse errors are expected; they are reported on stderr. */
+    for (int i = 1; i < ac || i == 1; i++) {
+        FILE *f = i < ac ? fopen(av[i], "r") : stdin;
+        if (f == NULL) {
+            perror(av[i]);
+            return EXIT_FAILURE;
+        }
+
+        size_t size;
+        char *input = read_all(f, &size);
+        LLVMFuzzerTestOneInput((const uint8_t *) input, size);
+        free(input);
+        if (f != stdin)
+            fclose(f);
+    }
+    return EXIT_SUCCESS;
+}
+#endif /* CUSH_LIBFUZZER */
@@ -0,0 +1,152 @@
+/*
+ * Plugins: builtins loaded from shared objects with dlopen.
+ *
+ * The interface plugins are written against is in cush-plugin.h.  Each
+ * builtin of a plugin is registered as a builtin of the shell, so it is
+ * found by the same single probe as the others and runs the way they
+ * do, in the shell or as a stage of a pipeline.  Plugins are never
+ * unloaded; enable -n disables their builtins like any other.
+ */
+#include <assert.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "commands.h"
+#include "plugins.h"
+#include "variables.h"
+
+/* A builtin of a plugin: the shell's description of it, which must
+ * come first, and the plugin's function */
+struct plugin_builtin {
+    struct builtin builtin;
+    cush_builtin_fn *run;
+};
+
+static char *plugin_dir;
+
+static const char *
+get_var(const char *name)
+{
+    return var_lookup(name, strlen(name));
+}
+
+static struct cush_shell shell = {
+    .size = sizeof shell,
+    .get_var = get_var,
+    .set_var = var_set,
+};
+
+void
+plugins_init(int (*next_job)(int jid), int (*get_job)(int jid, struct cush_job *job))
+{
+    shell.next_job = next_job;
+    shell.get_job = get_job;
+}
+
+/* The function of every plugin builtin, which finds the plugin's own
+ * function by the name it was run as */
+static int
+run_plugin_builtin(int argc, char **argv)
+{
+    const struct builtin *b = builtin_lookup(argv[0]);
+    assert(b && b->func == run_plugin_builtin);
+    const struct plugin_builtin *pb = (const struct plugin_builtin *) b;
+
+    struct cush_call call = {
+        sizeof call, &shell, argc, argv, STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO
+    };
+    var_set_status(pb->run(&call) & 0xff);
+    return BUILTIN_DONE;
+}
+
+static void
+add_builtin(const struct cush_plugin_builtin *desc)
+{
+    struct plugin_builtin *pb = malloc(sizeof *pb);
+    pb->builtin = (struct builtin) { desc->name, run_plugin_builtin, BUILTIN_PIPELINE };
+    pb->run = desc->run;
+    builtin_register(&pb->builtin, 1);
+}
+
+bool
+plugins_load(const char *path, char **names, int n)
+{
+    /* A plugin named without a / is looked for in the plugin directory
+     * before the places dlopen searches */
+    const char *file = path;
+    char candidate[plugin_dir ? strlen(plugin_dir) + strlen(path) + 2 : 1];
+    if (strchr(path, '/') == NULL && plugin_dir) {
+        sprintf(candidate, "%s/%s", plugin_dir, path);
+        if (access(candidate, F_OK) == 0)
+            file = candidate;
+    }
+    void *handle = dlopen(file, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) {
+        fprintf(stderr, "cush: enable: %s\n", dlerror());
+        return false;
+    }
+
+    const struct cush_plugin *plugin = dlsym(handle, "cush_plugin");
+    if (plugin == NULL || plugin->abi != CUSH_PLUGIN_ABI) {
+        fprintf(stderr, "cush: enable: %s: %s\n", path,
+                plugin ? "built for another version of cush" : "not a cush plugin");
+        dlclose(handle);
+        return false;
+    }
+
+    /* Without names, every builtin of the plugin is added */
+    bool ok = true;
+    int added = 0;
+    if (n == 0) {
+        for (const struct cush_plugin_builtin *b = plugin->builtins; b->name; b++, added++)
+            add_builtin(b);
+    }
+    for (int i = 0; i < n; i++) {
+        const struct cush_plugin_builtin *b = plugin->builtins;
+        while (b->name && strcmp(b->name, names[i]) != 0)
+            b++;
+        if (b->name) {
+            add_builtin(b);
+            added++;
+        } else {
+            fprintf(stderr, "cush: enable: %s: not found in %s\n", names[i], path);
+            ok = false;
+        }
+    }
+    if (added == 0)
+        dlclose(handle);
+    return ok;
+}
+
+static int
+is_plugin(const struct dirent *d)
+{
+    size_t len = strlen(d->d_name);
+    return len > 3 && strcmp(d->d_name + len - 3, ".so") == 0;
+}
+
+void
+plugins_load_dir(const char *dir)
+{
+    free(plugin_dir);
+    plugin_dir = strdup(dir);
+
+    struct dirent **entries;
+    int n = scandir(dir, &entries, is_plugin, alphasort);
+    if (n == -1) {
+        fprintf(stderr, "cush: %s: %s\n", dir, strerror(errno));
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        char path[strlen(dir) + strlen(entries[i]->d_name) + 2];
+        sprintf(path, "%s/%s", dir, entries[i]->d_name);
+        plugins_load(path, NULL, 0);
+        free(entries[i]);
+    }
+    free(entries);
+}
@@ -0,0 +1,21 @@
+#ifndef __PLUGINS_H
+#define __PLUGINS_H
+
+#include <stdbool.h>
+
+#include "cush-plugin.h"
+
+/* Let plugins see the job table through 'next_job' and 'get_job', which
+ * behave as described for struct cush_shell */
+void plugins_init(int (*next_job)(int jid), int (*get_job)(int jid, struct cush_job *job));
+
+/* Load every plugin (*.so) in directory 'dir', in alphabetical order.
+ * Plugins given to enable -f without a / are looked for there first. */
+void plugins_load_dir(const char *dir);
+
+/* Load plugin 'path' and register its builtins called 'names', or all
+ * of them if 'n' is 0.  Errors are reported on stderr.  Returns false
+ * if the plugin cannot be loaded or does not have all the names. */
+bool plugins_load(const char *path, char **names, int n);
+
+#endif /* __PLUGINS_H */
@@ -10,59 +10,56 @@
 #include <sys/types.h>
 #include <limits.h>
 #include <stdlib.h>
+#include <assert.h>
 
 #include "shell-ast.h"
 
-/* Create new command structure.  Takes ownership of argv. */
-struct ast_command * 
-ast_command_create(char ** argv, bool dup_stderr_to_stdout)
-{
-    struct ast_command *cmd = malloc(sizeof *cmd);
-
-    cmd->argv = argv;
-    cmd->dup_stderr_to_stdout = dup_stderr_to_stdout;
-    return cmd;
-}
+#define obstack_chunk_alloc malloc
+#define obstack_chunk_free free
 
-/* Create a new pipeline */
-struct ast_pipeline * ast_pipeline_create(char *iored_input, 
-                                          char *iored_output, 
-                                          bool append_to_output)
+/* Create a pipeline of a single command that is not part of a command
+ * line.  The pipeline and its command are allocated as one block. */
+struct ast_pipeline *
+ast_pipeline_create(char **argv,
+                    char *iored_input, 
+                    char *iored_output, 
+                    bool append_to_output)
 {
-    struct ast_pipeline *pipe = malloc(sizeof *pipe);
+    struct ast_pipeline *pipe = malloc(sizeof *pipe + sizeof *pipe->commands);
 
-    list_init(&pipe->commands);
+    pipe->commands = (struct ast_command *) (pipe + 1);
+    pipe->ncommands = 1;
+    pipe->commands[0] = (struct ast_command) {
+        .argv = argv,
+    };
     pipe->iored_output = iored_output;
     pipe->iored_input = iored_input;
     pipe->append_to_output = append_to_output;
     pipe->bg_job = false;
+    pipe->cmdline = NULL;
     return pipe;
 }
 
-/* Add a new command to this pipeline */
-void
-ast_pipeline_add_command(struct ast_pipeline *pipe, struct ast_command *cmd)
-{
-    list_push_back(&pipe->commands, &cmd->elem);
-}
-
-/* Create an empty command line */
+/* Create an empty command line.
+ * The command line is the first object in its own arena. */
 struct ast_command_line *
 ast_command_line_create_empty(void)
 {
-    struct ast_command_line *cmdline = malloc(sizeof *cmdline);
-
-    list_init(&cmdline->pipes);
-    return cmdline;
-}
-
-/* Create a command line with a single pipeline */
-struct ast_command_line *
-ast_command_line_create(struct ast_pipeline *pipe)
-{
-    struct ast_command_line *cmdline = ast_command_line_create_empty();
-
-    list_push_back(&cmdline->pipes, &pipe->elem);
+    struct obstack arena;
+    obstack_init(&arena);
+
+    struct ast_command_line *cmdline = obstack_alloc(&arena, sizeof *cmdline);
+    cmdline->arena = arena;
+    cmdline->pipes = NULL;
+    cmdline->npipes = 0;
+    cmdline->code = NULL;
+    cmdline->ncode = 0;
+    cmdline->loops = NULL;
+    cmdline->nloops = 0;
+    cmdline->loop_depth = 0;
+    cmdline->functions = NULL;
+    cmdline->nfunctions = 0;
+    cmdline->refcount = 1;
     return cmdline;
 }
 
@@ -86,16 +83,10 @@ ast_command_print(struct ast_command *cmd)
 void
 ast_pipeline_print(struct ast_pipeline *pipe)
 {
-    int i = 1;
-
-    printf(" Pipeline consists of %ld commands\n", list_size(&pipe->commands));
-    for (struct list_elem * e = list_begin(&pipe->commands); 
-         e != list_end(&pipe->commands); 
-         e = list_next(e)) {
-        struct ast_command *cmd = list_entry(e, struct ast_command, elem);
-
-        printf(" %d. ", i++);
-        ast_command_print(cmd);
+    printf(" Pipeline consists of %d commands\n", pipe->ncommands);
+    for (int i = 0; i < pipe->ncommands; i++) {
+        printf(" %d. ", i + 1);
+        ast_command_print(&pipe->commands[i]);
     }
 
     if (pipe->iored_output)
@@ -116,54 +107,56 @@ ast_pipeline_print(struct ast_pipeline *pipe)
 void 
 ast_command_line_print(struct ast_command_line *cmdline)
 {
-    printf("Command line\n");
-    for (struct list_elem * e = list_begin (&cmdline->pipes); 
-         e != list_end (&cmdline->pipes); 
-         e = list_next (e)) {
-        struct ast_pipeline *pipe = list_entry(e, struct ast_pipeline, elem);
+    static const char *opnames[] = {
+        [AST_RUN] = "run", [AST_JUMP] = "jump",
+        [AST_JUMP_IF_FAIL] = "jump-if-fail", [AST_JUMP_IF_OK] = "jump-if-ok",
+        [AST_SET_STATUS] = "set-status",
+        [AST_FOR_INIT] = "for-init", [AST_FOR_NEXT] = "for-next",
+        [AST_FUNCTION] = "function",
+    };
 
+    printf("Command line\n");
+    for (int i = 0; i < cmdline->npipes; i++) {
         printf(" ------------- \n");
-        ast_pipeline_print(pipe);
+        ast_pipeline_print(&cmdline->pipes[i]);
     }
+    for (int i = 0; i < cmdline->nloops; i++)
+        printf(" loop %d: for %s\n", i, cmdline->loops[i].name);
+    for (int i = 0; i < cmdline->nfunctions; i++)
+        printf(" function %d: %s, code %d to %d\n", i, cmdline->functions[i].name,
+               cmdline->functions[i].start, cmdline->functions[i].end);
+    printf(" Code:\n");
+    for (int i = 0; i < cmdline->ncode; i++)
+        printf("  %3d %s %u\n", i, opnames[cmdline->code[i].op], cmdline->code[i].arg);
     printf("==========================================\n");
 }
 
-/* Deallocation functions. */
-void 
-ast_command_line_free(struct ast_command_line *cmdline)
+/* Reference counting and deallocation functions. */
+struct ast_command_line *
+ast_command_line_ref(struct ast_command_line *cmdline)
 {
-    for (struct list_elem * e = list_begin(&cmdline->pipes); e != list_end(&cmdline->pipes); ) {
-        struct ast_pipeline *pipe = list_entry(e, struct ast_pipeline, elem);
-        e = list_remove(e);
-        ast_pipeline_free(pipe);
-    }
-    free(cmdline);
+    cmdline->refcount++;
+    return cmdline;
 }
 
 void 
-ast_pipeline_free(struct ast_pipeline *pipe)
+ast_command_line_unref(struct ast_command_line *cmdline)
 {
-    for (struct list_elem * e = list_begin(&pipe->commands); e != list_end(&pipe->commands); ) {
-        struct ast_command *cmd = list_entry(e, struct ast_command, elem);
-        e = list_remove(e);
-        ast_command_free(cmd);
-    }
-    if (pipe->iored_input)
-        free(pipe->iored_input);
-
-    if (pipe->iored_output)
-        free(pipe->iored_output);
+    if (--cmdline->refcount > 0)
+        return;
 
-    free(pipe);
+    /* The arena holds the command line itself, so free it from a copy. */
+    struct obstack arena = cmdline->arena;
+    obstack_free(&arena, NULL);
 }
 
+/* Frees the pipeline and the argv array of its command.  The words
+ * belong to whoever built the command. */
 void 
-ast_command_free(struct ast_command * cmd)
+ast_pipeline_free(struct ast_pipeline *pipe)
 {
-    char ** p = cmd->argv;
-    while (*p) {
-        free(*p++);
-    }
-    free(cmd->argv);
-    free(cmd);
+    assert(pipe->cmdline == NULL);
+    for (int i = 0; i < pipe->ncommands; i++)
+        free(pipe->commands[i].argv);
+    free(pipe);
 }
@@ -1,30 +1,91 @@
 #ifndef __SHELL_AST_H
 #define __SHELL_AST_H
 
-#include "list.h"
+#include <stdbool.h>
+#include <sys/types.h>
+#include <obstack.h>
 
 /* Forward declarations. */
 struct ast_command;
 struct ast_pipeline;
 struct ast_command_line;
 
-/* A command line may contain multiple pipelines. */
+/* The instructions a command line is compiled to.  run_command_line
+ * runs them in order, starting with the first one. */
+enum ast_opcode {
+    AST_RUN,                 /* Run pipeline 'arg', which sets $? */
+    AST_JUMP,                /* Continue with instruction 'arg' */
+    AST_JUMP_IF_FAIL,        /* Continue with instruction 'arg' if $? is not 0 */
+    AST_JUMP_IF_OK,          /* Continue with instruction 'arg' if $? is 0 */
+    AST_SET_STATUS,          /* Set $? to 'arg' */
+    AST_FOR_INIT,            /* Expand the words of loop 'arg' and enter it */
+    AST_FOR_NEXT,            /* Set the variable of the innermost loop to
+                                its next word, or leave the loop and
+                                continue with instruction 'arg' */
+    AST_FUNCTION,            /* Define function 'arg', whose body follows,
+                                and continue after the body */
+};
+
+#define AST_ARG_MAX ((1 << 24) - 1)
+
+struct ast_insn {
+    unsigned op : 8;         /* enum ast_opcode */
+    unsigned arg : 24;
+};
+
+/* A loop 'for name in words...' */
+struct ast_for {
+    char *name;
+    char **words;            /* NULL terminated, expanded on entry */
+};
+
+/* A function definition 'name() { ... }'.  Its body is the code from
+ * instruction 'start' up to, but not including, instruction 'end'. */
+struct ast_function {
+    char *name;
+    int start, end;
+};
+
+/* A command line may contain multiple pipelines. 
+ * Its pipelines, their commands and the words of all its commands
+ * are allocated from its arena, including the command line itself.
+ * Command lines are reference counted since jobs keep using their
+ * pipelines after the command line has been run.  They are not modified
+ * after parsing, so they can be cached and run any number of times.
+ *
+ * The control flow of the command line (;, &&, ||, if, while, for) is
+ * compiled to 'code', which refers to pipelines, loops and functions by
+ * their index.  A function keeps a reference to the command line it was
+ * defined in, since its body is part of the code.
+ */
 struct ast_command_line {
-    struct list/* <ast_pipeline> */ pipes;        /* List of pipelines */
+    struct ast_pipeline *pipes; /* Array of 'npipes' pipelines */
+    int npipes;              /* Number of pipelines */
+    struct ast_insn *code;   /* Array of 'ncode' instructions */
+    int ncode;
+    struct ast_for *loops;   /* Array of 'nloops' for loops */
+    int nloops;
+    int loop_depth;          /* Deepest nesting of for loops */
+    struct ast_function *functions; /* Array of 'nfunctions' functions */
+    int nfunctions;
+    struct obstack arena;    /* Storage for the entire command line */
+    int refcount;            /* Number of references to this command line */
 };
 
 /* A pipeline is a list of one or more commands. 
  * For the purposes of job control, a pipeline forms one job.
  */
 struct ast_pipeline {
-    struct list/* <ast_command> */ commands;    /* List of commands */
+    struct ast_command *commands; /* Array of 'ncommands' commands */
+    int ncommands;           /* Number of commands */
     char *iored_input;       /* If non-NULL, first command should read from
                                 file 'iored_input' */
     char *iored_output;      /* If non-NULL, last command should write to
                                 file 'iored_output' */
     bool append_to_output;   /* True if user typed >> to append */
     bool bg_job;             /* True if user entered & */
-    struct list_elem elem;   /* Link element. */
+    struct ast_command_line *cmdline; /* Command line this pipeline is part
+                                         of, or NULL if built by the shell */
 };
 
 /* A command is part of a pipeline. */
@@ -32,32 +93,27 @@ struct ast_command {
     char **argv;             /* NULL terminated array of pointers to words
                                 making up this command. */
     bool dup_stderr_to_stdout; /* True if stderr should be redirected as well */
-    struct list_elem elem;   /* Link element to link commands in pipeline. */
-    pid_t pid;               /* the pid of the command*/
 };
 
-/* Create new command structure and initialize it */
-struct ast_command * ast_command_create(char ** argv,
-                                        bool dup_stderr_to_stdout);
-
-/* Create a new pipeline containing only one command */
-struct ast_pipeline * ast_pipeline_create(char *iored_input, 
+/* Create a pipeline of a single command that is not part of a command
+ * line.  Takes ownership of the argv array, but not of the words it
+ * points to.  Such pipelines are freed with ast_pipeline_free. */
+struct ast_pipeline * ast_pipeline_create(char **argv,
+                                          char *iored_input, 
                                           char *iored_output, 
                                           bool append_to_output);
 
-/* Add a new command to this pipeline */
-void ast_pipeline_add_command(struct ast_pipeline *pipe, struct ast_command *cmd);
-
-/* Create an empty command line */
+/* Create an empty command line, allocated from its own arena */
 struct ast_command_line * ast_command_line_create_empty(void);
 
-/* Create a command line with a single pipeline */
-struct ast_command_line * ast_command_line_create(struct ast_pipeline *pipe);
+/* Take an additional reference to a command line */
+struct ast_command_line * ast_command_line_ref(struct ast_command_line *);
+
+/* Drop a reference; the last one frees the command line */
+void ast_command_line_unref(struct ast_command_line *);
 
-/* Deallocation functions */
-void ast_command_line_free(struct ast_command_line *);
+/* Free a pipeline created by ast_pipeline_create */
 void ast_pipeline_free(struct ast_pipeline *);
-void ast_command_free(struct ast_command *);
 
 /* Print functions */
 void ast_command_print(struct ast_command *cmd);
@@ -67,5 +123,10 @@ void ast_command_line_print(struct ast_command_line *line);
 /* Parse a command line.  Implemented in shell-grammar.y */
 struct ast_command_line * ast_parse_command_line(char * line);
 
+/* Parse the 'len' bytes at 'buf', which may span several lines, in place.
+ * The buffer must be writable and followed by two NUL bytes, as provided
+ * by utils_map_file; the scanner modifies it temporarily while parsing. */
+struct ast_command_line * ast_parse_buffer(char *buf, size_t len);
+
 /** ----------------------------------------------------------- */
 #endif /* __SHELL_AST_H */
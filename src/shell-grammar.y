@@ -9,15 +9,22 @@
  * This is based on an assignment as an undergraduate in 1993 
  * as an undergraduate student at Technische Universitaet Berlin.
  *
- * Known bugs: leaks memory when parse errors occur.
+ * Everything the parser allocates, including the helper structures
+ * below, comes from the arena of the command line being parsed, so
+ * nothing needs to be freed when a parse error occurs.  The only
+ * exception is the code of a long script, see emit().
+ *
+ * Control flow is compiled while parsing: every pipeline, and every
+ * test and jump of an if, while, for, && or ||, is emitted as an
+ * instruction as soon as it has been reduced.  Jumps forward are
+ * emitted with a target of 0 and patched once the target is known.
  */
 %{
 #include <stdio.h>
 #include <stdlib.h>
 #define YYDEBUG	1
 int yydebug;
-void yyerror(const char *msg);
-int yylex(void);
+typedef void *yyscan_t;
 
 /*
  * Error messages, csh-style
@@ -26,45 +33,129 @@ int yylex(void);
 #define INVNUL  "Invalid null command."
 #define AMBINP  "Ambiguous input redirect."
 #define AMBOUT  "Ambiguous output redirect."
+#define BADFOR  "Syntax error in for loop."
+#define BADBG   "Cannot run a compound command in the background."
+#define TOOLONG "Command line too long."
+#define SYNTAX  "Syntax error."
 
 #include "shell-ast.h"
 #include <obstack.h>
 #include <assert.h>
+#include <ctype.h>
+#include <string.h>
 
 #define obstack_chunk_alloc malloc
 #define obstack_chunk_free free
 
+struct pipe_node;
+struct loop_node;
+struct function_node;
+
+/* The state of one parse, passed to every action.  The parser keeps
+ * no global state, so separate threads may parse at the same time. */
+struct parser_context {
+    /* The command line being parsed.  It is created before parsing
+     * starts because the scanner allocates words from its arena. */
+    struct ast_command_line *commandline;
+
+    struct pipe_node *last_pipe;    /* pipelines, linked backwards */
+    int npipes;
+    struct loop_node *last_loop;    /* for loops, linked backwards */
+    int nloops;
+    struct function_node *last_function; /* functions, linked backwards */
+    int nfunctions;
+    int loop_depth;                 /* for loops around the current point */
+
+    /* The code emitted so far.  It starts out in code_buf and is moved
+     * to the heap if it outgrows it. */
+    struct ast_insn *code;
+    int ncode, code_capacity;
+    struct ast_insn code_buf[32];
+
+    /* The pipeline that ended the last and-or list, which a following &
+     * puts in the background; NULL if there is none. */
+    struct pipe_node *last_command;
+    bool last_compound;             /* it ended with a compound command */
+    bool reported;                  /* an error message has been printed */
+};
+
+static void *
+arena_alloc(struct parser_context *ctx, size_t size)
+{
+    return obstack_alloc(&ctx->commandline->arena, size);
+}
+
+/* Words, commands and pipelines are collected in lists that are linked
+ * backwards while they are parsed, and laid out as arrays once it is
+ * known how many there are. */
+struct word_node {
+    char *word;
+    struct word_node *prev;
+};
+
 struct cmd_helper {
-    struct obstack words;   /* an obstack of char * to collect argv */
+    struct word_node *last_word;
+    int nwords;
     char *iored_input;
     char *iored_output;
     bool append_to_output;
     bool redirect_stderr;
-    struct list_elem elem;
+    struct cmd_helper *prev;
 };
 
 struct pipe_helper {
-    struct list commands;
+    struct cmd_helper *first, *last;
+    int ncommands;
+};
+
+struct pipe_node {
+    struct ast_pipeline pipe;
+    int index;                      /* position in the pipes array */
+    struct pipe_node *prev;
+};
+
+struct loop_node {
+    struct ast_for loop;
+    struct loop_node *prev;
+};
+
+struct function_node {
+    struct ast_function function;
+    struct function_node *prev;
+};
+
+/* An if command while it is parsed */
+struct fi_jump {
+    int pos;
+    struct fi_jump *prev;
 };
 
-static struct pipe_helper *
-init_pipe()
+struct if_helper {
+    int test;                       /* jump taken when the last condition fails */
+    struct fi_jump *jumps;          /* jumps from the end of each branch to fi */
+};
+
+static void
+add_word(struct parser_context *ctx, struct cmd_helper *cmd, char *word)
 {
-    struct pipe_helper * pipe = calloc(1, sizeof *pipe);
-    list_init(&pipe->commands);
-    return pipe;
+    struct word_node *w = arena_alloc(ctx, sizeof *w);
+    w->word = word;
+    w->prev = cmd->last_word;
+    cmd->last_word = w;
+    cmd->nwords++;
 }
 
 /* Initialize cmd_helper and, optionally, set first argv */
 static struct cmd_helper *
-init_cmd(char *firstcmd, 
+init_cmd(struct parser_context *ctx, char *firstcmd, 
          char *iored_input, char *iored_output, 
          bool append_to_output, bool include_stderr)
 {
-    struct cmd_helper * cmd = malloc(sizeof *cmd);
-    obstack_init(&cmd->words);
+    struct cmd_helper * cmd = arena_alloc(ctx, sizeof *cmd);
+    cmd->last_word = NULL;
+    cmd->nwords = 0;
     if (firstcmd)
-        obstack_ptr_grow(&cmd->words, firstcmd);
+        add_word(ctx, cmd, firstcmd);
 
     cmd->iored_output = iored_output;
     cmd->iored_input = iored_input;
@@ -74,236 +165,515 @@ init_cmd(char *firstcmd,
 }
 
 /* print error message */
-static void p_error(char *msg);
+static void p_error(struct parser_context *ctx, char *msg);
 
 /* Convert cmd_helper to ast_command.
  * Ensures NULL-terminated argv[] array
  */
-static struct ast_command * 
-make_ast_command(struct cmd_helper *cmd)
+static struct ast_command
+make_ast_command(struct parser_context *ctx, struct cmd_helper *cmd)
 {
-    obstack_ptr_grow(&cmd->words, NULL);
+    char **argv = arena_alloc(ctx, (cmd->nwords + 1) * sizeof *argv);
+    argv[cmd->nwords] = NULL;
 
-    int sz = obstack_object_size(&cmd->words);
-    char **argv = malloc(sz);
-    memcpy(argv, obstack_finish(&cmd->words), sz);
-    obstack_free(&cmd->words, NULL);
+    struct word_node *w = cmd->last_word;
+    for (int i = cmd->nwords - 1; i >= 0; i--, w = w->prev)
+        argv[i] = w->word;
 
-    if (*argv == NULL) {
-        free(argv);
-        return NULL; 
-    }
-
-    return ast_command_create(argv, cmd->redirect_stderr);
+    return (struct ast_command) {
+        .argv = argv,
+        .dup_stderr_to_stdout = cmd->redirect_stderr,
+    };
 }
 
 static bool
-add_to_pipeline(struct pipe_helper *pipe,
+add_to_pipeline(struct parser_context *ctx,
+                struct pipe_helper *pipe,
                 struct cmd_helper *cmd,
                 bool redirect_stderr)
 {
-    if (!list_empty(&pipe->commands)) {
-        struct cmd_helper * last;
-        last = list_entry(list_back(&pipe->commands), 
-                          struct cmd_helper, elem);
+    if (pipe->last) {
+        struct cmd_helper * last = pipe->last;
         /* Error: 'ls >x | wc' */
-        if (last->iored_output) { p_error(AMBOUT); return false; }
+        if (last->iored_output) { p_error(ctx, AMBOUT); return false; }
         last->redirect_stderr = redirect_stderr;
 
         /* Error: 'ls | <x wc' */
-        if (cmd->iored_input) { p_error(AMBINP); return false; }
+        if (cmd->iored_input) { p_error(ctx, AMBINP); return false; }
+    }
+
+    if (cmd->nwords == 0) { p_error(ctx, INVNUL); return false; }
+
+    cmd->prev = pipe->last;
+    pipe->last = cmd;
+    if (pipe->first == NULL)
+        pipe->first = cmd;
+    pipe->ncommands++;
+    return true;
+}
+
+/* Convert pipe_helper to an ast_pipeline with an array of commands */
+static struct pipe_node *
+make_ast_pipeline(struct parser_context *ctx, struct pipe_helper *helper)
+{
+    struct pipe_node *node = arena_alloc(ctx, sizeof *node);
+    struct ast_pipeline *pipe = &node->pipe;
+
+    pipe->ncommands = helper->ncommands;
+    pipe->commands = arena_alloc(ctx, pipe->ncommands * sizeof *pipe->commands);
+    struct cmd_helper *cmd = helper->last;
+    for (int i = pipe->ncommands - 1; i >= 0; i--, cmd = cmd->prev)
+        pipe->commands[i] = make_ast_command(ctx, cmd);
+
+    pipe->iored_input = helper->first->iored_input;
+    pipe->iored_output = helper->last->iored_output;
+    pipe->append_to_output = helper->last->append_to_output;
+    pipe->bg_job = false;
+    pipe->cmdline = ctx->commandline;
+
+    node->index = ctx->npipes++;
+    node->prev = ctx->last_pipe;
+    ctx->last_pipe = node;
+    return node;
+}
+
+/* Append an instruction to the code and return its position */
+static int
+emit(struct parser_context *ctx, enum ast_opcode op, int arg)
+{
+    if (ctx->ncode == ctx->code_capacity) {
+        /* The code of a script may be long; it is copied into the
+         * arena once it is complete. */
+        ctx->code_capacity *= 2;
+        struct ast_insn *code = malloc(ctx->code_capacity * sizeof *code);
+        memcpy(code, ctx->code, ctx->ncode * sizeof *code);
+        if (ctx->code != ctx->code_buf)
+            free(ctx->code);
+        ctx->code = code;
     }
+    ctx->code[ctx->ncode] = (struct ast_insn) { .op = op, .arg = arg };
+    return ctx->ncode++;
+}
+
+/* Make the jump at 'pos' go to the next instruction to be emitted */
+static void
+patch_jump(struct parser_context *ctx, int pos)
+{
+    ctx->code[pos].arg = ctx->ncode;
+}
+
+/* End the current branch of an if command with a jump to its fi */
+static void
+add_fi_jump(struct parser_context *ctx, struct if_helper *helper)
+{
+    struct fi_jump *jump = arena_alloc(ctx, sizeof *jump);
+    jump->pos = emit(ctx, AST_JUMP, 0);
+    jump->prev = helper->jumps;
+    helper->jumps = jump;
+}
 
-    int sz = obstack_object_size(&cmd->words);
-    if (sz == 0) { p_error(INVNUL); return false; }
+static void
+patch_fi_jumps(struct parser_context *ctx, struct if_helper *helper)
+{
+    for (struct fi_jump *jump = helper->jumps; jump; jump = jump->prev)
+        patch_jump(ctx, jump->pos);
+}
 
-    list_push_back(&pipe->commands, &cmd->elem);
+/* The pipeline that ended an and-or list, or a compound command */
+static void
+set_last_command(struct parser_context *ctx, struct pipe_node *node)
+{
+    ctx->last_command = node;
+    ctx->last_compound = node == NULL;
+}
+
+/* Put the pipeline before a & in the background */
+static bool
+mark_background(struct parser_context *ctx)
+{
+    if (ctx->last_command == NULL) {
+        /* Error: '&' without a command */
+        p_error(ctx, ctx->last_compound ? BADBG : INVNUL);
+        return false;
+    }
+    ctx->last_command->pipe.bg_job = true;
+    set_last_command(ctx, NULL);
+    ctx->last_compound = false;
     return true;
 }
 
-/* Called by parser when command line is complete */
-static void cmdline_complete(struct ast_command_line *);
+/* Start 'for name in words...' and emit the instructions that enter it.
+ * Returns the position of the instruction that starts each iteration,
+ * or -1 on error. */
+static int
+start_for_loop(struct parser_context *ctx, char *name, char *in, struct cmd_helper *words)
+{
+    bool valid = strcmp(in, "in") == 0 && (isalpha((unsigned char) *name) || *name == '_');
+    for (char *c = name; *c; c++)
+        valid = valid && (isalnum((unsigned char) *c) || *c == '_');
+    if (!valid) {
+        p_error(ctx, BADFOR);
+        return -1;
+    }
+
+    struct loop_node *node = arena_alloc(ctx, sizeof *node);
+    node->loop.name = name;
+    node->loop.words = make_ast_command(ctx, words).argv;
+    node->prev = ctx->last_loop;
+    ctx->last_loop = node;
+
+    if (++ctx->loop_depth > ctx->commandline->loop_depth)
+        ctx->commandline->loop_depth = ctx->loop_depth;
+    emit(ctx, AST_FOR_INIT, ctx->nloops++);
+    return emit(ctx, AST_FOR_NEXT, 0);
+}
+
+/* Start the definition of function 'name' and emit the instruction
+ * that defines it; its body follows */
+static struct function_node *
+start_function(struct parser_context *ctx, char *name)
+{
+    struct function_node *node = arena_alloc(ctx, sizeof *node);
+    node->function.name = name;
+    emit(ctx, AST_FUNCTION, ctx->nfunctions++);
+    node->function.start = ctx->ncode;
+    node->prev = ctx->last_function;
+    ctx->last_function = node;
+    return node;
+}
 
-/* work-around for bug in flex 2.31 and later */
-static void yyunput (int c,char *buf_ptr  ) __attribute__((unused));
+/* Lay out the pipelines, loops and functions of the command line as
+ * arrays and copy its code into the arena */
+static bool
+finish_command_line(struct parser_context *ctx)
+{
+    if (ctx->ncode > AST_ARG_MAX || ctx->npipes > AST_ARG_MAX) {
+        p_error(ctx, TOOLONG);
+        return false;
+    }
+
+    struct ast_command_line *cmdline = ctx->commandline;
+    cmdline->npipes = ctx->npipes;
+    cmdline->pipes = arena_alloc(ctx, ctx->npipes * sizeof *cmdline->pipes);
+    struct pipe_node *node = ctx->last_pipe;
+    for (int i = ctx->npipes - 1; i >= 0; i--, node = node->prev)
+        cmdline->pipes[i] = node->pipe;
+
+    cmdline->nloops = ctx->nloops;
+    cmdline->loops = arena_alloc(ctx, ctx->nloops * sizeof *cmdline->loops);
+    struct loop_node *loop = ctx->last_loop;
+    for (int i = ctx->nloops - 1; i >= 0; i--, loop = loop->prev)
+        cmdline->loops[i] = loop->loop;
+
+    cmdline->nfunctions = ctx->nfunctions;
+    cmdline->functions = arena_alloc(ctx, ctx->nfunctions * sizeof *cmdline->functions);
+    struct function_node *function = ctx->last_function;
+    for (int i = ctx->nfunctions - 1; i >= 0; i--, function = function->prev)
+        cmdline->functions[i] = function->function;
+
+    cmdline->ncode = ctx->ncode;
+    cmdline->code = obstack_copy(&cmdline->arena, ctx->code, ctx->ncode * sizeof *ctx->code);
+    return true;
+}
 
 %}
 
+%define api.pure full
+%param {yyscan_t scanner}
+%parse-param {struct parser_context *ctx}
+
 /* LALR stack types */
 %union {
   struct cmd_helper *command;
   struct pipe_helper *pipe;
-  struct ast_pipeline *ast_pipe;
-  struct ast_command_line *cmdline;
+  struct pipe_node *ast_pipe;
+  struct if_helper *if_clause;
+  struct function_node *function;
   char *word;
+  int pos;
+}
+
+%code {
+int yylex(YYSTYPE *lvalp, yyscan_t scanner);
+void yyerror(yyscan_t scanner, struct parser_context *ctx, const char *msg);
 }
 
 /* Nonterminals */
 %type <command> input output
-%type <command> command
+%type <command> command for_words
 %type <pipe> pipeline
 %type <ast_pipe> ast_pipeline
-%type <cmdline> cmd_list
+%type <if_clause> if_head
+%type <function> function_head
 
 /* Terminals */
-%token <word> WORD
-%token GREATER_GREATER GREATER_AMPERSAND PIPE_AMPERSAND
+%token <word> WORD FUNCNAME
+%token GREATER_GREATER GREATER_AMPERSAND PIPE_AMPERSAND AND_IF OR_IF
+/* Reserved words, which the scanner only recognizes where a command starts */
+%token IF THEN ELIF ELSE FI WHILE DO DONE FOR LBRACE RBRACE
 
 %%
-cmd_line: cmd_list { cmdline_complete($1); }
-
-cmd_list:	/* Null Command */ { $$ = ast_command_line_create_empty(); }
-|		ast_pipeline { 
-            $$ = ast_command_line_create($1);
-        } 
-|		cmd_list ';'
-|		cmd_list '&' {
-            $$ = $1;
-            struct ast_pipeline * last;
-            last = list_entry(list_back(&$1->pipes), 
-                              struct ast_pipeline, elem);
-            last->bg_job = true;
+cmd_line: list { if (!finish_command_line(ctx)) YYABORT; }
+
+list:	/* Null Command */
+|		and_or
+|		list separator
+|		list separator and_or
+
+separator: ';'	{ set_last_command(ctx, NULL); ctx->last_compound = false; }
+|		'\n'	{ set_last_command(ctx, NULL); ctx->last_compound = false; }
+|		'&'	{ if (!mark_background(ctx)) YYABORT; }
+
+and_or:	command_unit
+|		and_or AND_IF { $<pos>$ = emit(ctx, AST_JUMP_IF_FAIL, 0); } linebreak command_unit {
+            patch_jump(ctx, $<pos>3);
+        }
+|		and_or OR_IF { $<pos>$ = emit(ctx, AST_JUMP_IF_OK, 0); } linebreak command_unit {
+            patch_jump(ctx, $<pos>3);
+        }
+
+linebreak: /* empty */
+|		linebreak '\n'
+
+command_unit: ast_pipeline {
+            emit(ctx, AST_RUN, $1->index);
+            set_last_command(ctx, $1);
+        }
+|		compound {
+            set_last_command(ctx, NULL);
+        }
+
+compound: if_clause
+|		while_clause
+|		for_clause
+|		LBRACE list RBRACE
+|		function_head LBRACE list RBRACE {
+            $1->function.end = ctx->ncode;
         }
-|		cmd_list ';' ast_pipeline	{ 
+
+/* name() { body } compiles to
+ *      function F; body;
+ *  F:
+ * The function instruction defines the function and skips its body. */
+function_head: FUNCNAME linebreak {
+            $$ = start_function(ctx, $1);
+        }
+
+/* if A; then B; elif C; then D; else E; fi compiles to
+ *      A; jump-if-fail L1; B; jump FI;
+ *  L1: C; jump-if-fail L2; D; jump FI;
+ *  L2: E;
+ *  FI:
+ * Without an else, the last test jumps to a set-status 0 instead. */
+if_clause: if_head FI {
+            add_fi_jump(ctx, $1);
+            patch_jump(ctx, $1->test);
+            emit(ctx, AST_SET_STATUS, 0);
+            patch_fi_jumps(ctx, $1);
+        }
+|		if_head ELSE {
+            add_fi_jump(ctx, $1);
+            patch_jump(ctx, $1->test);
+        } list FI {
+            patch_fi_jumps(ctx, $1);
+        }
+
+if_head: IF list THEN { $<pos>$ = emit(ctx, AST_JUMP_IF_FAIL, 0); } list {
+            $$ = arena_alloc(ctx, sizeof *$$);
+            $$->test = $<pos>4;
+            $$->jumps = NULL;
+        }
+|		if_head ELIF {
+            add_fi_jump(ctx, $1);
+            patch_jump(ctx, $1->test);
+        } list THEN { $<pos>$ = emit(ctx, AST_JUMP_IF_FAIL, 0); } list {
             $$ = $1;
-            list_push_back(&$$->pipes, &$3->elem);
+            $$->test = $<pos>6;
         }
-|		cmd_list '&' ast_pipeline	{ 
-            struct ast_pipeline * last;
-            last = list_entry(list_back(&$1->pipes), 
-                              struct ast_pipeline, elem);
-            last->bg_job = true;
 
+/* while A; do B; done compiles to
+ *  L: A; jump-if-fail END; B; jump L;
+ *  END: set-status 0 */
+while_clause: WHILE { $<pos>$ = ctx->ncode; } list DO {
+            $<pos>$ = emit(ctx, AST_JUMP_IF_FAIL, 0);
+        } list DONE {
+            emit(ctx, AST_JUMP, $<pos>2);
+            patch_jump(ctx, $<pos>5);
+            emit(ctx, AST_SET_STATUS, 0);
+        }
+
+/* for x in W; do B; done compiles to
+ *      for-init; L: for-next END; B; jump L;
+ *  END: */
+for_clause: FOR WORD WORD for_words for_separator linebreak DO {
+            if (($<pos>$ = start_for_loop(ctx, $2, $3, $4)) == -1)
+                YYABORT;
+        } list DONE {
+            emit(ctx, AST_JUMP, $<pos>8);
+            patch_jump(ctx, $<pos>8);
+            ctx->loop_depth--;
+        }
+|		FOR error { p_error(ctx, BADFOR); YYABORT; }
+
+for_words: /* empty */ {
+            $$ = init_cmd(ctx, NULL, NULL, NULL, false, false);
+        }
+|		for_words WORD {
             $$ = $1;
-            list_push_back(&$$->pipes, &$3->elem);
+            add_word(ctx, $$, $2);
         }
 
+for_separator: ';'
+|		'\n'
+
 ast_pipeline: pipeline {
-            struct pipe_helper * pipe = $1;
-            assert (!list_empty(&pipe->commands));
-            struct cmd_helper * first;
-            first = list_entry(list_front(&pipe->commands), struct cmd_helper, elem);
-            struct cmd_helper * last;
-            last = list_entry(list_back(&pipe->commands), struct cmd_helper, elem);
-
-            $$ = ast_pipeline_create(
-                first->iored_input,
-                last->iored_output,
-                last->append_to_output
-            );
-            for (struct list_elem * e = list_begin(&pipe->commands);
-                                    e != list_end(&pipe->commands);) {
-                struct cmd_helper * cmd = list_entry(e, struct cmd_helper, elem);
-                ast_pipeline_add_command($$, make_ast_command(cmd));
-                e = list_remove(e);
-                free(cmd);
-            }
-            free(pipe);
+            $$ = make_ast_pipeline(ctx, $1);
         }
 
 pipeline: command {
-            $$ = init_pipe();
-            if (!add_to_pipeline($$, $1, false))
+            $$ = arena_alloc(ctx, sizeof *$$);
+            $$->first = $$->last = NULL;
+            $$->ncommands = 0;
+            if (!add_to_pipeline(ctx, $$, $1, false))
                 YYABORT;
 		}
 |		pipeline '|' command {
-            if (!add_to_pipeline($1, $3, false))
+            if (!add_to_pipeline(ctx, $1, $3, false))
                 YYABORT;
             $$ = $1;
 		}
 |		pipeline PIPE_AMPERSAND command {
-            if (!add_to_pipeline($1, $3, true))
+            if (!add_to_pipeline(ctx, $1, $3, true))
                 YYABORT;
             $$ = $1;
 		}
-|		'|' error 	   { p_error(INVNUL); YYABORT; }
-|		pipeline '|' error { p_error(INVNUL); YYABORT; }
+|		'|' error 	   { p_error(ctx, INVNUL); YYABORT; }
+|		pipeline '|' error { p_error(ctx, INVNUL); YYABORT; }
 
 command:   WORD { 
-            $$ = init_cmd($1, NULL, NULL, false, false);
+            $$ = init_cmd(ctx, $1, NULL, NULL, false, false);
         }
 |		input   
 |		output
 |		command WORD {
             $$ = $1;
-            obstack_ptr_grow(&$$->words, $2);
+            add_word(ctx, $$, $2);
 		}
 |		command input {
-            obstack_free(&$2->words, NULL);
             /* Error: ambiguous redirect 'a <b <c' */
-            if ($1->iored_input)   { p_error(AMBINP); YYABORT; }
+            if ($1->iored_input)   { p_error(ctx, AMBINP); YYABORT; }
             $$ = $1; 
             $$->iored_input = $2->iored_input;
-            free($2);
 		}
 |		command output {
-            obstack_free(&$2->words, NULL);
             /* Error: ambiguous redirect 'a >b >c' */
-            if ($1->iored_output) { p_error(AMBOUT); YYABORT; }
+            if ($1->iored_output) { p_error(ctx, AMBOUT); YYABORT; }
             $$ = $1; 
             $$->iored_output = $2->iored_output;
             $$->append_to_output = $2->append_to_output;
             $$->redirect_stderr = $2->redirect_stderr;
-            free($2);
 		}
 
 input:	'<' WORD { 
-            $$ = init_cmd(NULL, $2, NULL, false, false);
+            $$ = init_cmd(ctx, NULL, $2, NULL, false, false);
         }
-|		'<' error	  { p_error(MISRED); YYABORT; }
+|		'<' error	  { p_error(ctx, MISRED); YYABORT; }
 
 output:	'>' WORD { 
-            $$ = init_cmd(NULL, NULL, $2, false, false);
+            $$ = init_cmd(ctx, NULL, NULL, $2, false, false);
         }
 |		GREATER_AMPERSAND WORD { 
-            $$ = init_cmd(NULL, NULL, $2, false, true);
+            $$ = init_cmd(ctx, NULL, NULL, $2, false, true);
         }
 |		GREATER_GREATER WORD { 
-            $$ = init_cmd(NULL, NULL, $2, true, false);
+            $$ = init_cmd(ctx, NULL, NULL, $2, true, false);
         }
 		/* Error: missing redirect */
-|		'>' error 	  { p_error(MISRED); YYABORT; }
-|		GREATER_GREATER error { p_error(MISRED); YYABORT; }
+|		'>' error 	  { p_error(ctx, MISRED); YYABORT; }
+|		GREATER_GREATER error { p_error(ctx, MISRED); YYABORT; }
 
 %%
-static char * inputline;    /* currently processed input line */
-#define YY_INPUT(buf,result,max_size) \
-    { \
-        result = *inputline ? (buf[0] = *inputline++, 1) : YY_NULL; \
-    }
-
-#define YY_NO_INPUT
 #include "lex.yy.c"
 
 static void
-p_error(char *msg) 
+p_error(struct parser_context *ctx, char *msg) 
 { 
     /* print error */
     fprintf(stderr, "%s\n", msg); 
+    ctx->reported = true;
 }
 
-extern int yyparse (void);
+extern int yyparse (yyscan_t scanner, struct parser_context *ctx);
 
 /* do not use default error handling since errors are handled above. */
 void 
-yyerror(const char *msg) { }
+yyerror(yyscan_t scanner, struct parser_context *ctx, const char *msg) { }
 
-static struct ast_command_line * commandline;
-static void cmdline_complete(struct ast_command_line *cline)
+/* Parse the input the scanner has been given into the command line
+ * of 'ctx'.  Consumes the scanner. */
+static struct ast_command_line *
+parse(yyscan_t scanner, YY_BUFFER_STATE buffer, struct parser_context *ctx)
 {
-    commandline = cline;
+    ctx->code = ctx->code_buf;
+    ctx->code_capacity = sizeof ctx->code_buf / sizeof *ctx->code_buf;
+
+    int error = yyparse(scanner, ctx);
+    yy_delete_buffer(buffer, scanner);
+    yylex_destroy(scanner);
+    if (ctx->code != ctx->code_buf)
+        free(ctx->code);
+
+    if (error) {
+        /* Errors without a production of their own, e.g. a misplaced fi */
+        if (!ctx->reported)
+            p_error(ctx, SYNTAX);
+        ast_command_line_unref(ctx->commandline);
+        return NULL;
+    }
+    return ctx->commandline;
 }
 
 /* 
  * parse a commandline.
+ * The scanner is given the entire line at once.
+ * This function is reentrant and may be called from any thread.
  */
 struct ast_command_line *
 ast_parse_command_line(char * line)
 {
-    inputline = line;
-    commandline = NULL;
+    struct parser_context ctx = {
+        .commandline = ast_command_line_create_empty(),
+    };
+    yyscan_t scanner;
+    if (yylex_init_extra(&ctx.commandline->arena, &scanner)) {
+        ast_command_line_unref(ctx.commandline);
+        return NULL;
+    }
 
-    int error = yyparse();
+    YY_BUFFER_STATE buffer = yy_scan_bytes(line, strlen(line), scanner);
+    return parse(scanner, buffer, &ctx);
+}
 
-    return error ? NULL : commandline;
+/*
+ * parse a whole script in place, without copying it into the scanner.
+ */
+struct ast_command_line *
+ast_parse_buffer(char *buf, size_t len)
+{
+    struct parser_context ctx = {
+        .commandline = ast_command_line_create_empty(),
+    };
+    yyscan_t scanner;
+    if (yylex_init_extra(&ctx.commandline->arena, &scanner)) {
+        ast_command_line_unref(ctx.commandline);
+        return NULL;
+    }
+
+    YY_BUFFER_STATE buffer = yy_scan_buffer(buf, len + 2, scanner);
+    if (buffer == NULL) {
+        yylex_destroy(scanner);
+        ast_command_line_unref(ctx.commandline);
+        return NULL;
+    }
+    return parse(scanner, buffer, &ctx);
 }
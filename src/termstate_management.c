@@ -17,7 +17,8 @@
 #include "utils.h"
 #include "signal_support.h"
 
-static int terminal_fd = -1;           /* The controlling terminal */
+static int terminal_fd = -1;           /* The controlling terminal, or -1 if
+                                          the shell runs without one */
 static struct termios saved_tty_state; /* The state of the terminal when shell
                                            was started. */
 static int shell_pgrp;          /* The pgrp of the shell when it started */
@@ -40,11 +41,31 @@ termstate_init(void)
     termstate_sample();
 }
 
+/* Does the shell manage a terminal?  If termstate_init was not called,
+ * as when running a script, the other functions do nothing. */
+bool
+termstate_has_terminal(void)
+{
+    return terminal_fd != -1;
+}
+
+/* Stop managing the terminal.  The terminal settings are left alone. */
+void
+termstate_release(void)
+{
+    if (terminal_fd != -1)
+        close(terminal_fd);
+    terminal_fd = -1;
+}
+
 /* Save current terminal settings.
  * This function is used when a job is suspended.*/
 void 
 termstate_save(struct termios *saved_tty_state)
 {
+    if (terminal_fd == -1)
+        return;
+
     int rc = tcgetattr(terminal_fd, saved_tty_state);
     if (rc == -1)
         utils_fatal_error("tcgetattr failed: ");
@@ -90,6 +111,9 @@ termstate_get_tty_fd(void)
 void
 termstate_give_terminal_to(struct termios *pg_tty_state, pid_t pgrp)
 {
+    if (terminal_fd == -1)
+        return;
+
     signal_block(SIGTTOU);
     int rc = tcsetpgrp(termstate_get_tty_fd(), pgrp);
     if (rc == -1)
@@ -103,6 +127,9 @@ termstate_give_terminal_to(struct termios *pg_tty_state, pid_t pgrp)
 void 
 termstate_give_terminal_back_to_shell(void)
 {
+    if (terminal_fd == -1)
+        return;
+
     assert (shell_pgrp > 0 || !!!"termstate_init was not called");
     termstate_give_terminal_to(&saved_tty_state, shell_pgrp);
 }
@@ -2,10 +2,20 @@
 #define __TERMSTATE_MANAGEMENT_H
 
 #include <sys/types.h>
+#include <stdbool.h>
 
 /* Initialize tty support. */
 void termstate_init(void);
 
+/* Return true if termstate_init has been called.  Without it, the shell
+ * runs without a terminal and the functions below do nothing, except
+ * for termstate_get_tty_fd, which must not be called. */
+bool termstate_has_terminal(void);
+
+/* Stop managing the terminal, as in a child of the shell that runs part
+ * of a job: termstate_has_terminal returns false from then on. */
+void termstate_release(void);
+
 /* Save current terminal settings.
  * This function should be called when a job is suspended and the
  * state should be saved for this job so it can be restored with
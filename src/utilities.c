@@ -0,0 +1,680 @@
+/*
+ * Builtin versions of the utilities that scripts run most often: echo,
+ * printf, test and [, true, false, pwd and sleep.
+ *
+ * As programs, each of them costs a posix_spawnp, that is a clone and
+ * an exec, and a reap through the SIGCHLD handler, for work that takes
+ * a few microseconds.  As builtins they run inside the shell, or in a
+ * forked child when they are a stage of a pipeline.  They support the
+ * options of the GNU coreutils programs that scripts use; enable -n
+ * NAME makes NAME run the program again.
+ */
+#define _GNU_SOURCE 1
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "commands.h"
+#include "utilities.h"
+#include "variables.h"
+
+static volatile sig_atomic_t *interrupted;
+
+/* Report an error of utility 'name', which fails with 'status' */
+static void
+fail(const char *name, int status, const char *fmt, const char *arg)
+{
+    fprintf(stderr, "cush: %s: ", name);
+    fprintf(stderr, fmt, arg);
+    fputc('\n', stderr);
+    var_set_status(status);
+}
+
+/* Flush the output of utility 'name', which fails if it cannot be
+ * written */
+static void
+finish_output(const char *name)
+{
+    if (fflush(stdout) == EOF) {
+        fail(name, 1, "write error: %s", strerror(errno));
+        clearerr(stdout);
+    }
+}
+
+static bool
+is_octal(char c)
+{
+    return c >= '0' && c <= '7';
+}
+
+/* Write the character that the backslash escape at 's' stands for to
+ * 'out', and return the last character of the escape.  Octal escapes
+ * are \nnn; with 'zero', as for echo and printf's %b, they may also be
+ * \0nnn.  Sets *stop for \c, which ends the
+ * output. */
+static const char *
+put_escape(FILE *out, const char *s, bool zero, bool *stop)
+{
+    int c;
+    switch (*++s) {
+    case 'a': c = '\a'; break;
+    case 'b': c = '\b'; break;
+    case 'e': c = 033; break;
+    case 'f': c = '\f'; break;
+    case 'n': c = '\n'; break;
+    case 'r': c = '\r'; break;
+    case 't': c = '\t'; break;
+    case 'v': c = '\v'; break;
+    case '\\': c = '\\'; break;
+    case 'c':
+        *stop = true;
+        return s;
+    case 'x':
+        if (!isxdigit((unsigned char) s[1]))
+            goto literal;
+        c = 0;
+        for (int n = 0; n < 2 && isxdigit((unsigned char) s[1]); n++) {
+            s++;
+            c = c * 16 + (isdigit((unsigned char) *s) ? *s - '0' : (tolower((unsigned char) *s) - 'a' + 10));
+        }
+        break;
+    case '0': case '1': case '2': case '3':
+    case '4': case '5': case '6': case '7':
+        c = *s - '0';
+        for (int n = zero && c == 0 ? -1 : 0; n < 2 && is_octal(s[1]); n++)
+            c = c * 8 + (*++s - '0');
+        break;
+    case '\0':
+        c = '\\';     /* a trailing backslash is itself */
+        s--;
+        break;
+    default:
+    literal:
+        fputc('\\', out);
+        c = *s;
+        break;
+    }
+    fputc(c, out);
+    return s;
+}
+
+/* Write 's' to 'out' with its backslash escapes interpreted.  Returns
+ * false if \c ended the output. */
+static bool
+put_escaped(FILE *out, const char *s, bool zero)
+{
+    bool stop = false;
+    for (; *s && !stop; s++) {
+        if (*s == '\\')
+            s = put_escape(out, s, zero, &stop);
+        else
+            fputc(*s, out);
+    }
+    return !stop;
+}
+
+/* echo [-neE] [arg...] */
+static int
+utility_echo(int argc, char **argv)
+{
+    bool newline = true, escapes = false;
+    int i = 1;
+
+    /* An argument is only an option if it is made of these letters */
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+        const char *p = argv[i] + 1;
+        if (p[strspn(p, "neE")] != '\0')
+            break;
+        for (; *p; p++) {
+            if (*p == 'n')
+                newline = false;
+            else
+                escapes = *p == 'e';
+        }
+    }
+
+    for (int first = i; i < argc; i++) {
+        if (i > first)
+            putchar(' ');
+        if (!escapes)
+            fputs(argv[i], stdout);
+        else if (!put_escaped(stdout, argv[i], true)) {
+            newline = false;
+            break;
+        }
+    }
+    if (newline)
+        putchar('\n');
+    finish_output("echo");
+    return BUILTIN_DONE;
+}
+
+/* The arguments of a printf that have not been used yet */
+struct printf_args {
+    char **argv;
+    int argc;
+    bool failed;            /* an argument was not a valid number */
+};
+
+static const char *
+next_arg(struct printf_args *a)
+{
+    if (a->argc == 0)
+        return NULL;
+    a->argc--;
+    return *a->argv++;
+}
+
+/* Check that the number in 's' ended at 'end' */
+static void
+check_number(struct printf_args *a, const char *s, const char *end)
+{
+    if (end == s || *end != '\0' || errno == ERANGE) {
+        fail("printf", 1, "%s: invalid number", s);
+        a->failed = true;
+    }
+}
+
+/* The next argument as an integer.  A leading quote stands for the code
+ * of the character after it.  Missing arguments are 0. */
+static intmax_t
+int_arg(struct printf_args *a)
+{
+    const char *s = next_arg(a);
+    if (s == NULL)
+        return 0;
+    if (*s == '\'' || *s == '"')
+        return (unsigned char) s[1];
+
+    char *end;
+    errno = 0;
+    intmax_t v = *s == '-' ? strtoimax(s, &end, 0) : (intmax_t) strtoumax(s, &end, 0);
+    check_number(a, s, end);
+    return v;
+}
+
+static long double
+float_arg(struct printf_args *a)
+{
+    const char *s = next_arg(a);
+    if (s == NULL)
+        return 0;
+    if (*s == '\'' || *s == '"')
+        return (unsigned char) s[1];
+
+    char *end;
+    errno = 0;
+    long double v = strtold(s, &end);
+    check_number(a, s, end);
+    return v;
+}
+
+/* Print 'format' once, taking the values of its conversions from 'a'.
+ * Returns false if the output must stop, because of \c or an invalid
+ * conversion. */
+static bool
+print_format(const char *format, struct printf_args *a)
+{
+    for (const char *p = format; *p; p++) {
+        bool stop = false;
+        if (*p == '\\') {
+            p = put_escape(stdout, p, false, &stop);
+            if (stop)
+                return false;
+            continue;
+        }
+        if (*p != '%') {
+            putchar(*p);
+            continue;
+        }
+        if (p[1] == '%') {
+            putchar(*++p);
+            continue;
+        }
+
+        /* The conversion is done by printf itself, with the width and
+         * precision given as arguments: %<flags>*.*<length><conversion> */
+        char spec[16] = "%", *q = spec + 1;
+        while (*++p && strchr("-+ #0", *p))
+            if (q < spec + 6)
+                *q++ = *p;
+        int width = 0, precision = -1;
+        if (*p == '*') {
+            width = int_arg(a);
+            p++;
+        } else {
+            for (; isdigit((unsigned char) *p); p++)
+                width = width * 10 + (*p - '0');
+        }
+        if (*p == '.') {
+            precision = 0;
+            if (*++p == '*') {
+                precision = int_arg(a);
+                p++;
+            } else {
+                for (; isdigit((unsigned char) *p); p++)
+                    precision = precision * 10 + (*p - '0');
+            }
+        }
+        while (*p && strchr("hlLjzt", *p))
+            p++;
+        q = stpcpy(q, "*.*");
+
+        const char *s;
+        switch (*p) {
+        case 'd': case 'i':
+            q[0] = 'j', q[1] = *p, q[2] = '\0';
+            printf(spec, width, precision, int_arg(a));
+            break;
+        case 'o': case 'u': case 'x': case 'X':
+            q[0] = 'j', q[1] = *p, q[2] = '\0';
+            printf(spec, width, precision, (uintmax_t) int_arg(a));
+            break;
+        case 'e': case 'E': case 'f': case 'F':
+        case 'g': case 'G': case 'a': case 'A':
+            q[0] = 'L', q[1] = *p, q[2] = '\0';
+            printf(spec, width, precision, float_arg(a));
+            break;
+        case 'c':
+            precision = 1;
+            /* fall through */
+        case 's':
+            s = next_arg(a);
+            strcpy(q, "s");
+            printf(spec, width, precision, s ? s : "");
+            break;
+        case 'b': {
+            /* The argument with its escapes interpreted, padded as a %s */
+            char *text;
+            size_t len;
+            FILE *out = open_memstream(&text, &len);
+            s = next_arg(a);
+            stop = !put_escaped(out, s ? s : "", true);
+            fclose(out);
+            strcpy(q, "s");
+            printf(spec, width, precision, text);
+            free(text);
+            if (stop)
+                return false;
+            break;
+        }
+        case '\0':
+            fail("printf", 1, "%s: missing format character", format);
+            return false;
+        default:
+            fprintf(stderr, "cush: printf: %%%c: invalid conversion\n", *p);
+            var_set_status(1);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* printf format [arg...]
+ * The format is used again as long as there are arguments left. */
+static int
+utility_printf(int argc, char **argv)
+{
+    if (argc < 2) {
+        fail("printf", 1, "%s", "usage: printf format [arguments]");
+        return BUILTIN_DONE;
+    }
+
+    struct printf_args a = { argv + 2, argc - 2, false };
+    for (;;) {
+        int left = a.argc;
+        if (!print_format(argv[1], &a) || a.argc == 0 || a.argc == left)
+            break;
+    }
+    if (a.failed)
+        var_set_status(1);
+    finish_output("printf");
+    return BUILTIN_DONE;
+}
+
+/* An expression of test, being evaluated */
+struct test {
+    const char *name;       /* test or [ */
+    char **argv;            /* the words not yet evaluated */
+    int argc;
+    bool error;
+};
+
+static bool test_or(struct test *t);
+
+static bool
+is_unary(const char *op)
+{
+    return op[0] == '-' && op[1] && op[2] == '\0' && strchr("bcdefghknprsStuwxzGLNO", op[1]);
+}
+
+static const char *const binary_ops[] = {
+    "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge",
+    "-nt", "-ot", "-ef", NULL
+};
+
+/* Return the index of binary operator 'op' in binary_ops, or -1 */
+static int
+binary_op(const char *op)
+{
+    for (int i = 0; binary_ops[i]; i++)
+        if (strcmp(op, binary_ops[i]) == 0)
+            return i;
+    return -1;
+}
+
+static bool
+test_unary(char op, const char *arg)
+{
+    struct stat st;
+    if (op == 'n' || op == 'z')
+        return (*arg != '\0') == (op == 'n');
+    if (op == 't') {
+        char *end;
+        long fd = strtol(arg, &end, 10);
+        return end != arg && *end == '\0' && fd >= 0 && fd <= INT32_MAX && isatty(fd);
+    }
+    if (op == 'r' || op == 'w' || op == 'x') {
+        int mode = op == 'r' ? R_OK : op == 'w' ? W_OK : X_OK;
+        return faccessat(AT_FDCWD, arg, mode, AT_EACCESS) == 0;
+    }
+    if (op == 'h' || op == 'L')
+        return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+    if (stat(arg, &st) != 0)
+        return false;
+
+    switch (op) {
+    case 'b': return S_ISBLK(st.st_mode);
+    case 'c': return S_ISCHR(st.st_mode);
+    case 'd': return S_ISDIR(st.st_mode);
+    case 'e': return true;
+    case 'f': return S_ISREG(st.st_mode);
+    case 'g': return st.st_mode & S_ISGID;
+    case 'k': return st.st_mode & S_ISVTX;
+    case 'p': return S_ISFIFO(st.st_mode);
+    case 's': return st.st_size > 0;
+    case 'S': return S_ISSOCK(st.st_mode);
+    case 'u': return st.st_mode & S_ISUID;
+    case 'G': return st.st_gid == getegid();
+    case 'O': return st.st_uid == geteuid();
+    case 'N': return st.st_mtime > st.st_atime;
+    }
+    return false;
+}
+
+/* Parse integer operand 's' of a comparison */
+static long long
+test_int(struct test *t, const char *s)
+{
+    char *end;
+    errno = 0;
+    long long v = strtoll(s, &end, 10);
+    while (isspace((unsigned char) *end))
+        end++;
+    if (end == s || *end != '\0' || errno == ERANGE) {
+        fail(t->name, 2, "%s: integer expression expected", s);
+        t->error = true;
+    }
+    return v;
+}
+
+/* Compare the modification times of files 'l' and 'r' */
+static int
+compare_mtimes(const char *l, const char *r)
+{
+    struct stat a, b;
+    bool hl = stat(l, &a) == 0, hr = stat(r, &b) == 0;
+    if (!hl || !hr)
+        return hl - hr;     /* a file that exists is newer */
+    if (a.st_mtim.tv_sec != b.st_mtim.tv_sec)
+        return a.st_mtim.tv_sec < b.st_mtim.tv_sec ? -1 : 1;
+    return (a.st_mtim.tv_nsec > b.st_mtim.tv_nsec) - (a.st_mtim.tv_nsec < b.st_mtim.tv_nsec);
+}
+
+static bool
+test_binary(struct test *t, const char *l, int op, const char *r)
+{
+    struct stat a, b;
+    switch (op) {
+    case 0: case 1: return strcmp(l, r) == 0;
+    case 2: return strcmp(l, r) != 0;
+    case 3: return strcoll(l, r) < 0;
+    case 4: return strcoll(l, r) > 0;
+    case 11: return compare_mtimes(l, r) > 0;
+    case 12: return compare_mtimes(l, r) < 0;
+    case 13:
+        return stat(l, &a) == 0 && stat(r, &b) == 0
+               && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+    }
+
+    long long x = test_int(t, l), y = test_int(t, r);
+    switch (op) {
+    case 5: return x == y;
+    case 6: return x != y;
+    case 7: return x < y;
+    case 8: return x <= y;
+    case 9: return x > y;
+    default: return x >= y;
+    }
+}
+
+/* primary: ( expr ) | -op word | word op word | word */
+static bool
+test_primary(struct test *t)
+{
+    if (t->argc == 0) {
+        fail(t->name, 2, "%s", "argument expected");
+        t->error = true;
+        return false;
+    }
+
+    char **w = t->argv;
+    int op;
+    if (t->argc >= 3 && (op = binary_op(w[1])) >= 0) {
+        t->argv += 3, t->argc -= 3;
+        return test_binary(t, w[0], op, w[2]);
+    }
+    if (strcmp(w[0], "(") == 0) {
+        t->argv++, t->argc--;
+        bool v = test_or(t);
+        if (t->argc == 0 || strcmp(t->argv[0], ")") != 0) {
+            if (!t->error)
+                fail(t->name, 2, "%s", "`)' expected");
+            t->error = true;
+            return false;
+        }
+        t->argv++, t->argc--;
+        return v;
+    }
+    if (t->argc >= 2 && is_unary(w[0])) {
+        t->argv += 2, t->argc -= 2;
+        return test_unary(w[0][1], w[1]);
+    }
+    t->argv++, t->argc--;
+    return w[0][0] != '\0';
+}
+
+/* not: ! not | primary */
+static bool
+test_not(struct test *t)
+{
+    if (t->argc > 1 && strcmp(t->argv[0], "!") == 0) {
+        t->argv++, t->argc--;
+        return !test_not(t);
+    }
+    return test_primary(t);
+}
+
+/* and: not [-a and] */
+static bool
+test_and(struct test *t)
+{
+    bool v = test_not(t);
+    while (!t->error && t->argc > 0 && strcmp(t->argv[0], "-a") == 0) {
+        t->argv++, t->argc--;
+        v = test_not(t) && v;
+    }
+    return v;
+}
+
+/* or: and [-o or] */
+static bool
+test_or(struct test *t)
+{
+    bool v = test_and(t);
+    while (!t->error && t->argc > 0 && strcmp(t->argv[0], "-o") == 0) {
+        t->argv++, t->argc--;
+        v = test_and(t) || v;
+    }
+    return v;
+}
+
+/* test expr, or [ expr ]: the status is 0 if expr is true, 1 if it is
+ * false, and 2 if it is not valid */
+static int
+utility_test(int argc, char **argv)
+{
+    struct test t = { argv[0], argv + 1, argc - 1, false };
+    if (strcmp(argv[0], "[") == 0) {
+        if (argc < 2 || strcmp(argv[argc - 1], "]") != 0) {
+            fail("[", 2, "%s", "missing `]'");
+            return BUILTIN_DONE;
+        }
+        t.argc--;
+    }
+
+    /* A single word is true if it is not empty, even if it looks like
+     * an operator, and so is the word after a !. */
+    bool v;
+    if (t.argc == 0)
+        v = false;
+    else if (t.argc == 1)
+        v = t.argv[0][0] != '\0';
+    else if (t.argc == 2 && strcmp(t.argv[0], "!") == 0)
+        v = t.argv[1][0] == '\0';
+    else {
+        v = test_or(&t);
+        if (!t.error && t.argc > 0) {
+            fail(t.name, 2, "%s: unexpected argument", t.argv[0]);
+            t.error = true;
+        }
+    }
+    if (!t.error)
+        var_set_status(!v);
+    return BUILTIN_DONE;
+}
+
+static int
+utility_true(int argc, char **argv)
+{
+    return BUILTIN_DONE;
+}
+
+static int
+utility_false(int argc, char **argv)
+{
+    var_set_status(1);
+    return BUILTIN_DONE;
+}
+
+/* pwd [-LP]: with -L, the default, $PWD if it names the current
+ * directory, so that the path by which it was reached is kept */
+static int
+utility_pwd(int argc, char **argv)
+{
+    bool logical = true;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-L") == 0 || strcmp(argv[i], "-P") == 0)
+            logical = argv[i][1] == 'L';
+        else {
+            fail("pwd", 1, "%s: invalid option", argv[i]);
+            return BUILTIN_DONE;
+        }
+    }
+
+    const char *pwd = getenv("PWD");
+    struct stat a, b;
+    if (logical && pwd && pwd[0] == '/' && stat(pwd, &a) == 0 && stat(".", &b) == 0
+        && a.st_dev == b.st_dev && a.st_ino == b.st_ino) {
+        puts(pwd);
+    } else {
+        char *cwd = getcwd(NULL, 0);
+        if (cwd == NULL) {
+            fail("pwd", 1, "%s", strerror(errno));
+            return BUILTIN_DONE;
+        }
+        puts(cwd);
+        free(cwd);
+    }
+    finish_output("pwd");
+    return BUILTIN_DONE;
+}
+
+/* sleep number[smhd]...: sleep for the sum of the intervals */
+static int
+utility_sleep(int argc, char **argv)
+{
+    if (argc < 2) {
+        fail("sleep", 1, "%s", "missing operand");
+        return BUILTIN_DONE;
+    }
+
+    double seconds = 0;
+    for (int i = 1; i < argc; i++) {
+        char *end;
+        double v = strtod(argv[i], &end);
+        double unit = 1;
+        switch (*end) {
+        case 's': end++; break;
+        case 'm': unit = 60; end++; break;
+        case 'h': unit = 3600; end++; break;
+        case 'd': unit = 86400; end++; break;
+        }
+        if (end == argv[i] || *end != '\0' || !(v >= 0)) {
+            fail("sleep", 1, "invalid time interval '%s'", argv[i]);
+            return BUILTIN_DONE;
+        }
+        seconds += v * unit;
+    }
+
+    struct timespec ts = { INT32_MAX, 0 };
+    if (seconds < INT32_MAX) {
+        ts.tv_sec = seconds;
+        ts.tv_nsec = (seconds - ts.tv_sec) * 1e9;
+    }
+    /* Other signals, such as the SIGCHLD of a background job, only
+     * interrupt the sleep for a moment; ^C ends it. */
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
+        if (interrupted && *interrupted) {
+            var_set_status(130);
+            break;
+        }
+    }
+    return BUILTIN_DONE;
+}
+
+static const struct builtin utilities[] = {
+    {"echo", utility_echo, BUILTIN_PIPELINE},
+    {"printf", utility_printf, BUILTIN_PIPELINE},
+    {"test", utility_test, BUILTIN_PIPELINE},
+    {"[", utility_test, BUILTIN_PIPELINE},
+    {"true", utility_true, BUILTIN_PIPELINE},
+    {"false", utility_false, BUILTIN_PIPELINE},
+    {"pwd", utility_pwd, BUILTIN_PIPELINE},
+    {"sleep", utility_sleep, BUILTIN_PIPELINE},
+};
+
+void
+utilities_register(volatile sig_atomic_t *flag)
+{
+    interrupted = flag;
+    builtin_register(utilities, sizeof utilities / sizeof *utilities);
+}
@@ -0,0 +1,11 @@
+#ifndef __UTILITIES_H
+#define __UTILITIES_H
+
+#include <signal.h>
+
+/* Register the builtin versions of echo, printf, test and [, true,
+ * false, pwd and sleep.  'interrupted' is the flag the shell sets when
+ * the user types ^C, which cuts a sleep short. */
+void utilities_register(volatile sig_atomic_t *interrupted);
+
+#endif /* __UTILITIES_H */
@@ -0,0 +1,80 @@
+#!/usr/bin/python
+#
+# Tests the builtin echo, printf, test and [, and pwd: their output and
+# exit status, and that enable -n hands a name back to the program.
+#
+import atexit, proc_check, time
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+#################################################################
+# Step 1. echo: -n leaves out the newline, -e interprets escapes.
+#
+sendline("echo -n ab; echo -e 'c\\tdone'")
+expect_exact("abc\tdone", "echo -n or echo -e did not work")
+expect_prompt("Shell did not print expected prompt (2)")
+
+#################################################################
+# Step 2. printf: conversions with flags, widths and precisions, %b,
+# and the format reused until the arguments are used up.
+#
+sendline("printf '%s=%03d|%-4s|%x\\n' n 7 ab 255 m 8")
+expect_exact("n=007|ab  |ff\r\nm=008|    |0", "printf did not format its arguments")
+expect_prompt("Shell did not print expected prompt (3)")
+
+sendline("printf '%b|%5.2f|%*d\\n' 'x\\ty' 3.14159 4 42")
+expect_exact("x\ty| 3.14|  42", "printf %b, precision or * width did not work")
+expect_prompt("Shell did not print expected prompt (4)")
+
+#################################################################
+# Step 3. test and [: ! binds tighter than -a, and -a tighter than
+# -o; parentheses group; a malformed expression has status 2.
+#
+sendline("test 1 -lt 2 -a ! -z '' -o x = y; echo st=$?")
+expect_exact("st=1", "test did not give ! and -a precedence over -o")
+expect_prompt("Shell did not print expected prompt (5)")
+
+sendline("test x = y -o 1 -lt 2 -a -n x; echo st=$?")
+expect_exact("st=0", "test did not give -a precedence over -o")
+expect_prompt("Shell did not print expected prompt (6)")
+
+sendline("[ '(' 1 -eq 2 -o 3 -gt 2 ')' -a -n x ]; echo st=$?")
+expect_exact("st=0", "[ did not group with parentheses")
+expect_prompt("Shell did not print expected prompt (7)")
+
+sendline("[ 1 -eq ]; echo st=$?")
+expect_exact("st=2", "[ did not reject a malformed expression")
+expect_prompt("Shell did not print expected prompt (8)")
+
+#################################################################
+# Step 4. pwd prints the directory cd changed to.
+#
+import tempfile, shutil, os
+tmpdir = os.path.realpath(tempfile.mkdtemp("-cush-utilities-test"))
+
+def cleanup():
+    shutil.rmtree(tmpdir)
+
+atexit.register(cleanup)
+
+sendline("cd " + tmpdir + "; pwd | tr / :")
+expect_exact(tmpdir.replace("/", ":"), "pwd did not print the current directory")
+expect_prompt("Shell did not print expected prompt (9)")
+
+#################################################################
+# Step 5. enable -n echo makes echo the program again, and enable
+# echo makes it the builtin.
+#
+sendline("enable -n echo; type echo")
+expect("echo is /\\S*echo\r\n", "enable -n did not make echo the program")
+expect_prompt("Shell did not print expected prompt (10)")
+
+sendline("enable echo; type echo")
+expect_exact("echo is a shell builtin", "enable did not make echo a builtin again")
+expect_prompt("Shell did not print expected prompt (11)")
+
+test_success()
@@ -10,6 +10,9 @@
 #include <stdarg.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "utils.h"
 
@@ -57,3 +60,45 @@ utils_set_cloexec(int fd)
     return fcntl(fd, F_SETFD, oldflags | FD_CLOEXEC);
 }
 
+/* Size of the region utils_map_file reserves for a file of 'size' bytes */
+static size_t
+map_region_size(size_t size)
+{
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    return (size + 2 + pagesize - 1) / pagesize * pagesize;
+}
+
+/* Map the file open on 'fd' privately and writably, followed by at least
+ * two NUL bytes.
+ * An anonymous, zero-filled region is reserved first and the file is
+ * mapped over its beginning, so the bytes after the end of the file are
+ * zero even when the file size is a multiple of the page size.
+ */
+char *
+utils_map_file(int fd, size_t *size)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+        return NULL;
+
+    *size = st.st_size;
+    char *map = mmap(NULL, map_region_size(*size), PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    if (*size > 0 && mmap(map, *size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        munmap(map, map_region_size(*size));
+        return NULL;
+    }
+    return map;
+}
+
+/* Release a mapping returned by utils_map_file */
+void
+utils_unmap_file(char *map, size_t size)
+{
+    munmap(map, map_region_size(size));
+}
@@ -1,3 +1,5 @@
+#include <stddef.h>
+
 /* Set the 'close-on-exec' flag on fd, return error indicator */
 int utils_set_cloexec(int fd);
 
@@ -6,3 +8,11 @@ void utils_error(char *fmt, ...);
 
 /* Print information about the last syscall error and then exit */
 void utils_fatal_error(char *fmt, ...);
+
+/* Map the file open on 'fd' privately and writably, followed by at least
+ * two NUL bytes.  Stores the file size in *size.  Returns NULL on error.
+ * Release the mapping with utils_unmap_file. */
+char *utils_map_file(int fd, size_t *size);
+
+/* Release a mapping returned by utils_map_file */
+void utils_unmap_file(char *map, size_t size);
@@ -0,0 +1,178 @@
+/*
+ * Shell variables.
+ *
+ * Shell variables are kept in a hash table.  Exported variables are
+ * stored in the environment instead, which is passed to every command
+ * the shell starts; a lookup falls back to the environment, so
+ * variables the shell inherited can be expanded as well.
+ */
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "variables.h"
+
+#define VAR_BUCKETS 256   /* must be a power of 2 */
+
+struct variable {
+    struct variable *next;
+    char *value;
+    char name[];
+};
+
+static struct variable *buckets[VAR_BUCKETS];
+static int last_status;
+static pid_t shell_pid;
+static int positional_count;
+static char **positional;
+
+/* 32-bit FNV-1a */
+static uint32_t
+hash_name(const char *name, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char) name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Return the link that points to the variable, or to the NULL at the
+ * end of its bucket if it does not exist */
+static struct variable **
+find(const char *name, size_t len)
+{
+    struct variable **p = &buckets[hash_name(name, len) & (VAR_BUCKETS - 1)];
+    while (*p && !(strncmp((*p)->name, name, len) == 0 && (*p)->name[len] == '\0'))
+        p = &(*p)->next;
+    return p;
+}
+
+const char *
+var_lookup(const char *name, size_t len)
+{
+    struct variable *var = *find(name, len);
+    if (var)
+        return var->value;
+
+    char envname[len + 1];
+    memcpy(envname, name, len);
+    envname[len] = '\0';
+    return getenv(envname);
+}
+
+void
+var_set(const char *name, const char *value)
+{
+    if (getenv(name)) {
+        setenv(name, value, 1);
+        return;
+    }
+
+    size_t len = strlen(name);
+    struct variable **p = find(name, len);
+    if (*p == NULL) {
+        *p = malloc(sizeof **p + len + 1);
+        memcpy((*p)->name, name, len + 1);
+        (*p)->next = NULL;
+    } else {
+        free((*p)->value);
+    }
+    (*p)->value = strdup(value);
+}
+
+/* Remove shell variable 'name', if it exists */
+static void
+remove_variable(const char *name)
+{
+    struct variable **p = find(name, strlen(name));
+    struct variable *var = *p;
+    if (var) {
+        *p = var->next;
+        free(var->value);
+        free(var);
+    }
+}
+
+void
+var_export(const char *name)
+{
+    struct variable *var = *find(name, strlen(name));
+    if (var) {
+        setenv(name, var->value, 1);
+        remove_variable(name);
+    }
+}
+
+void
+var_unset(const char *name)
+{
+    remove_variable(name);
+    unsetenv(name);
+}
+
+bool
+var_valid_name(const char *name, size_t len)
+{
+    if (len == 0 || isdigit((unsigned char) name[0]))
+        return false;
+    for (size_t i = 0; i < len; i++)
+        if (!isalnum((unsigned char) name[i]) && name[i] != '_')
+            return false;
+    return true;
+}
+
+char *
+var_assignment(const char *word)
+{
+    char *eq = strchr(word, '=');
+    if (eq && var_valid_name(word, eq - word))
+        return eq;
+    return NULL;
+}
+
+void
+var_set_status(int status)
+{
+    last_status = status;
+}
+
+int
+var_status(void)
+{
+    return last_status;
+}
+
+void
+var_set_shell_pid(pid_t pid)
+{
+    shell_pid = pid;
+}
+
+pid_t
+var_shell_pid(void)
+{
+    return shell_pid;
+}
+
+void
+var_set_positional(int argc, char **argv)
+{
+    positional_count = argc;
+    positional = argv;
+}
+
+void
+var_get_positional(int *argc, char ***argv)
+{
+    *argc = positional_count;
+    *argv = positional;
+}
+
+const char *
+var_positional(int n)
+{
+    return n < positional_count ? positional[n] : NULL;
+}
@@ -0,0 +1,47 @@
+#ifndef __VARIABLES_H
+#define __VARIABLES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Return the value of the variable whose name is the 'len' bytes at
+ * 'name', or NULL if it is not set.  Shell variables take precedence
+ * over the environment.  The value is valid until the variable is
+ * changed.
+ */
+const char *var_lookup(const char *name, size_t len);
+
+/* Set shell variable 'name'.  If it is exported, the environment is
+ * updated as well. */
+void var_set(const char *name, const char *value);
+
+/* Export shell variable 'name' to the environment */
+void var_export(const char *name);
+
+/* Remove variable 'name' from the shell and the environment */
+void var_unset(const char *name);
+
+/* If 'word' has the form NAME=value, return the position of the '=',
+ * else NULL. */
+char *var_assignment(const char *word);
+
+/* Return true if the 'len' bytes at 'name' form a valid variable name */
+bool var_valid_name(const char *name, size_t len);
+
+/* The exit status of the last foreground pipeline, as $? */
+void var_set_status(int status);
+int var_status(void);
+
+/* The process id of the shell, as $$.  It is recorded once at startup,
+ * so that it stays the same in the children the shell forks. */
+void var_set_shell_pid(pid_t pid);
+pid_t var_shell_pid(void);
+
+/* The positional parameters $0, $1, ...
+ * The array must remain valid while it is in use. */
+void var_set_positional(int argc, char **argv);
+void var_get_positional(int *argc, char ***argv);
+const char *var_positional(int n);
+
+#endif /* __VARIABLES_H */